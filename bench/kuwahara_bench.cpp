@@ -0,0 +1,107 @@
+#include <omp.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "Image.h"
+#include "filters/KuwaharaFilter.h"
+
+// Times every Kuwahara engine at a few window sizes.
+// Usage: kuwahara_bench [image] [repetitions]
+// Without an image a 1920x1080 RGB test pattern is used.
+
+namespace {
+imgr::Image test_pattern(int width, int height) {
+  imgr::Image img;
+  img.m_width = width;
+  img.m_height = height;
+  img.m_channels = 3;
+  img.m_name = "pattern";
+  img.m_data.resize(static_cast<size_t>(width) * height * 3);
+
+  // Smooth gradients with hashed noise, so regions differ in variance
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const unsigned hash = (x * 73856093u) ^ (y * 19349663u);
+      for (int c = 0; c < 3; ++c) {
+        const int value = (x * (c + 1) + y * (3 - c)) / 8 +
+                          static_cast<int>((hash >> (8 * c)) & 31);
+        img.m_data[(static_cast<size_t>(y) * width + x) * 3 + c] =
+            static_cast<uint8_t>(value & 255);
+      }
+    }
+  }
+
+  return img;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const imgr::Image source =
+      argc > 1 ? imgr::Image(argv[1]) : test_pattern(1920, 1080);
+  const int repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 3;
+
+  if (source.m_data.empty()) {
+    std::cerr << "Could not load " << argv[1] << "\n";
+    return -1;
+  }
+
+  const std::vector<std::pair<const char*, imgr::KuwaharaEngine>> engines = {
+      {"direct", imgr::KuwaharaEngine::direct},
+      {"sat", imgr::KuwaharaEngine::summed_area},
+      {"sliding", imgr::KuwaharaEngine::sliding},
+      {"fused", imgr::KuwaharaEngine::fused},
+      {"pyramid", imgr::KuwaharaEngine::pyramid},
+  };
+
+  std::cout << source.m_width << "x" << source.m_height << "x"
+            << source.m_channels << ", " << omp_get_max_threads()
+            << " threads, best of " << repetitions << " (ms)\n";
+  std::cout << std::setw(8) << "window";
+  for (const auto& engine : engines) {
+    std::cout << std::setw(10) << engine.first;
+  }
+  std::cout << "\n";
+
+  for (int window_size : {7, 15, 31, 63}) {
+    std::cout << std::setw(8) << window_size;
+
+    for (const auto& engine : engines) {
+      // The direct engine is quadratic in the window, skip the slow cases;
+      // below 31 the pyramid engine is sat
+      if ((engine.second == imgr::KuwaharaEngine::direct &&
+           window_size > 15) ||
+          (engine.second == imgr::KuwaharaEngine::pyramid &&
+           window_size < 31)) {
+        std::cout << std::setw(10) << "-";
+        continue;
+      }
+
+      double best = 0.0;
+      for (int i = 0; i < repetitions; ++i) {
+        imgr::Image img = source;
+
+        // The filter reports its layout on stdout, keep the table readable
+        std::ostringstream discard;
+        std::streambuf* previous = std::cout.rdbuf(discard.rdbuf());
+        const double start = omp_get_wtime();
+        imgr::KuwaharaFilter::apply_kuwara_filter_parallel(
+            img, window_size, imgr::BorderMode::clamp, engine.second);
+        const double elapsed = (omp_get_wtime() - start) * 1000.0;
+        std::cout.rdbuf(previous);
+
+        best = i == 0 ? elapsed : std::min(best, elapsed);
+      }
+
+      std::cout << std::setw(10) << std::fixed << std::setprecision(1)
+                << best;
+    }
+    std::cout << "\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#ifndef IMGR_BUFFER_POOL_H
+#  define IMGR_BUFFER_POOL_H
+
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <cstdlib>
+#  include <cstring>
+#  include <mutex>
+#  include <new>
+#  include <unordered_map>
+#  include <vector>
+
+#  ifdef __linux__
+#    include <sys/mman.h>
+#  endif
+
+namespace imgr {
+// Where pixel buffers come from. Every block starts on a cache line, blocks
+// of 2 MiB and up on a huge page boundary. Sizes are rounded up to a class,
+// four per power of two, so at most a fifth of a block goes unused. Released
+// blocks are kept per class, up to a cache limit, and handed to the next
+// image or temporary of a similar size. Batch runs then stop mapping fresh
+// memory and faulting it in page by page for every image. Thread safe.
+class BufferPool {
+ public:
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kHugePageSize = size_t{2} << 20;
+  static constexpr size_t kMinClass = 4096;
+  static constexpr size_t kDefaultCacheLimit = size_t{512} << 20;
+
+  struct Stats {
+    size_t hits;          // allocations served from the cache
+    size_t misses;        // allocations that went to the system
+    size_t cached_bytes;  // held for reuse right now
+  };
+
+  // Never destroyed, so images with static storage duration can still give
+  // their buffers back at exit
+  static BufferPool& instance() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+  }
+
+  // Smallest class that holds `size` bytes
+  static size_t size_class(size_t size) {
+    if (size <= kMinClass) {
+      return kMinClass;
+    }
+    size_t power = kMinClass;
+    while (power * 2 < size) {
+      power *= 2;
+    }
+    const size_t step = power / 4;
+    return (size + step - 1) / step * step;
+  }
+
+  // At least `size` bytes; `capacity` receives the class size, which must
+  // be passed back to release
+  uint8_t* allocate(size_t size, size_t& capacity) {
+    capacity = size_class(size);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::vector<uint8_t*>& blocks = m_free[capacity];
+      if (!blocks.empty()) {
+        uint8_t* block = blocks.back();
+        blocks.pop_back();
+        m_cached_bytes -= capacity;
+        ++m_hits;
+        return block;
+      }
+      ++m_misses;
+    }
+
+    uint8_t* block = static_cast<uint8_t*>(
+        ::operator new(capacity, std::align_val_t(alignment(capacity))));
+#  if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (m_huge_pages && capacity >= kHugePageSize) {
+      // Advisory: without THP support the block keeps normal pages
+      madvise(block, capacity, MADV_HUGEPAGE);
+    }
+#  endif
+    return block;
+  }
+
+  void release(uint8_t* block, size_t capacity) {
+    if (block == nullptr) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_cached_bytes + capacity <= m_cache_limit) {
+        m_free[capacity].push_back(block);
+        m_cached_bytes += capacity;
+        return;
+      }
+    }
+    free_block(block, capacity);
+  }
+
+  // Returns every cached block to the system
+  void trim() {
+    std::unordered_map<size_t, std::vector<uint8_t*>> blocks;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      blocks.swap(m_free);
+      m_cached_bytes = 0;
+    }
+    for (const auto& [capacity, list] : blocks) {
+      for (uint8_t* block : list) {
+        free_block(block, capacity);
+      }
+    }
+  }
+
+  // Most bytes kept for reuse; 0 disables the cache
+  void set_cache_limit(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_cache_limit = bytes;
+      if (m_cached_bytes <= m_cache_limit) {
+        return;
+      }
+    }
+    trim();
+  }
+
+  // Asks for transparent huge pages on new blocks of 2 MiB and up. Off
+  // unless IMGR_HUGE_PAGES=1 is set; Linux only.
+  void set_huge_pages(bool enabled) { m_huge_pages = enabled; }
+  bool huge_pages() const { return m_huge_pages; }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return {m_hits, m_misses, m_cached_bytes};
+  }
+
+ private:
+  BufferPool()
+      : m_cache_limit(kDefaultCacheLimit),
+        m_cached_bytes(0),
+        m_hits(0),
+        m_misses(0),
+        m_huge_pages(false) {
+    const char* huge = std::getenv("IMGR_HUGE_PAGES");
+    m_huge_pages = huge != nullptr && std::strcmp(huge, "1") == 0;
+  }
+
+  // Fixed per class, so a block is freed with the alignment it was made with
+  static size_t alignment(size_t capacity) {
+    return capacity >= kHugePageSize ? kHugePageSize : kAlignment;
+  }
+
+  static void free_block(uint8_t* block, size_t capacity) {
+    ::operator delete(block, std::align_val_t(alignment(capacity)));
+  }
+
+  mutable std::mutex m_mutex;
+  std::unordered_map<size_t, std::vector<uint8_t*>> m_free;
+  size_t m_cache_limit;
+  size_t m_cached_bytes;
+  size_t m_hits;
+  size_t m_misses;
+  std::atomic<bool> m_huge_pages;
+};
+}  // namespace imgr
+
+#endif  // !IMGR_BUFFER_POOL_H
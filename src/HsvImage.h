@@ -0,0 +1,189 @@
+#pragma once
+
+#ifndef IMGR_HSV_IMAGE_H
+#  define IMGR_HSV_IMAGE_H
+
+#  include <algorithm>
+#  include <cmath>
+#  include <cstddef>
+#  include <cstdint>
+#  include <iostream>
+#  include <vector>
+
+#  include "Image.h"
+#  include "parallel.h"
+#  include "simd/aligned_allocator.h"
+#  include "simd/hsv.h"
+#  include "simd/interleave.h"
+
+namespace imgr {
+// An RGB or RGBA image as float hue, saturation and value planes. A chain of
+// adjustments on it is rounded to 8 bits once, by to_rgb, instead of after
+// every step as with Image::rgb_to_hsv.
+struct HsvImage {
+  int m_width;
+  int m_height;
+  int m_channels;                           // of the RGB image, 3 or 4
+  simd::AlignedVector<float> m_hue;         // degrees, [0, 360)
+  simd::AlignedVector<float> m_saturation;  // [0, 1]
+  simd::AlignedVector<float> m_value;       // [0, 1]
+  std::vector<uint8_t> m_alpha;             // RGBA only
+
+  HsvImage() : m_width(0), m_height(0), m_channels(0) {}
+
+  explicit HsvImage(ConstImageView image, bool parallel = false)
+      : HsvImage() {
+    from_rgb(image, parallel);
+  }
+
+  void from_rgb(ConstImageView image, bool parallel = false) {
+    if (image.empty()) {
+      std::cerr << "Empty image to convert to HSV!\n";
+      return;
+    }
+
+    if (image.channels() < 3 || image.channels() > 4) {
+      std::cerr << "HSV needs an RGB or RGBA image, got "
+                << image.channels() << " channels.\n";
+      return;
+    }
+
+    if (image.planar()) {
+      with_interleaved(image, parallel, [&](ConstImageView pixels) {
+        from_rgb(pixels, parallel);
+      });
+      return;
+    }
+
+    m_width = image.width();
+    m_height = image.height();
+    m_channels = image.channels();
+    m_hue.resize(pixel_count());
+    m_saturation.resize(pixel_count());
+    m_value.resize(pixel_count());
+    m_alpha.resize(m_channels == 4 ? pixel_count() : 0);
+
+    const simd::PlaneScale to_unit = {1.0f / 255.0f, 1.0f / 255.0f,
+                                      1.0f / 255.0f};
+    for_each_run(image, kBlockPixels, parallel, [&](int y, int x, int count) {
+      const size_t first = static_cast<size_t>(y) * m_width + x;
+      float* const planes[3] = {m_hue.data() + first,
+                                m_saturation.data() + first,
+                                m_value.data() + first};
+      simd::deinterleave_row(image.row(y) + x * m_channels, count, m_channels,
+                             to_unit, planes,
+                             m_alpha.empty() ? nullptr : &m_alpha[first]);
+      simd::rgb_to_hsv(planes, count);
+    });
+  }
+
+  // Replaces the pixels of a whole image, which keeps its name and path, or
+  // writes into a region of the same size
+  void to_rgb(ImageView image, bool parallel = false) const {
+    if (m_hue.empty()) {
+      std::cerr << "Empty image to convert to RBG!\n";
+      return;
+    }
+
+    if (image.planar()) {
+      with_interleaved(image, parallel,
+                       [&](ImageView pixels) { to_rgb(pixels, parallel); });
+      return;
+    }
+
+    if (Image* whole = image.image()) {
+      whole->allocate(m_width, m_height, m_channels,
+                      PixelLayout::interleaved, whole->m_padded);
+    } else if (image.width() != m_width || image.height() != m_height ||
+               image.channels() != m_channels) {
+      std::cerr << "Region to convert to RGB is " << image.width() << "x"
+                << image.height() << "x" << image.channels() << ", expected "
+                << m_width << "x" << m_height << "x" << m_channels << ".\n";
+      return;
+    }
+
+    const simd::PlaneScale to_byte = {255.0f, 255.0f, 255.0f};
+    // Converted in a per-thread scratch, the planes stay as they are
+    const auto make_scratch = [] {
+      return std::vector<float>(size_t{kBlockPixels} * 3);
+    };
+    for_each_run(
+        image, kBlockPixels, parallel, make_scratch,
+        [&](std::vector<float>& rgb, int y, int x, int count) {
+          const size_t first = static_cast<size_t>(y) * m_width + x;
+          float* const planes[3] = {rgb.data(), rgb.data() + count,
+                                    rgb.data() + 2 * count};
+          std::copy_n(&m_hue[first], count, planes[0]);
+          std::copy_n(&m_saturation[first], count, planes[1]);
+          std::copy_n(&m_value[first], count, planes[2]);
+          simd::hsv_to_rgb(planes, count);
+          simd::interleave_row(planes,
+                               m_alpha.empty() ? nullptr : &m_alpha[first],
+                               count, m_channels, to_byte,
+                               image.row(y) + x * m_channels);
+        });
+  }
+
+  // Rotates every hue by `degrees`, either way round
+  void shift_hue(float degrees, bool parallel = false) {
+    const float turn = std::fmod(degrees, 360.0f);
+    const float shift = turn < 0.0f ? turn + 360.0f : turn;
+
+    for_blocks(parallel, [&](size_t first, int count) {
+      float* hue = m_hue.data() + first;
+#  pragma omp simd
+      for (int i = 0; i < count; ++i) {
+        // No branch: whether a hue wraps depends on the pixel
+        const float shifted = hue[i] + shift;
+        hue[i] = shifted - 360.0f * static_cast<float>(shifted >= 360.0f);
+      }
+    });
+  }
+
+  // Multiplies saturation by `factor`, clamped to [0, 1]
+  void scale_saturation(float factor, bool parallel = false) {
+    scale_plane(m_saturation, factor, parallel);
+  }
+
+  // Multiplies value by `factor`, clamped to [0, 1]
+  void scale_value(float factor, bool parallel = false) {
+    scale_plane(m_value, factor, parallel);
+  }
+
+ private:
+  // Pixels per work item, as for grayscale: three float planes of a block
+  // stay in L2 between the conversion steps
+  static constexpr int kBlockPixels = 1 << 13;
+
+  size_t pixel_count() const {
+    return static_cast<size_t>(m_width) * m_height;
+  }
+
+  // Calls body(first pixel, pixel count) for consecutive blocks of pixels
+  template <typename Body>
+  void for_blocks(bool parallel, Body&& body) const {
+    const size_t pixels = pixel_count();
+    const int num_blocks =
+        static_cast<int>((pixels + kBlockPixels - 1) / kBlockPixels);
+
+    parallel_for_rows(0, num_blocks, parallel, [&](int block) {
+      const size_t first = static_cast<size_t>(block) * kBlockPixels;
+      body(first,
+           static_cast<int>(std::min<size_t>(kBlockPixels, pixels - first)));
+    });
+  }
+
+  void scale_plane(simd::AlignedVector<float>& plane, float factor,
+                   bool parallel) {
+    for_blocks(parallel, [&](size_t first, int count) {
+      float* values = plane.data() + first;
+#  pragma omp simd
+      for (int i = 0; i < count; ++i) {
+        values[i] = std::min(std::max(values[i] * factor, 0.0f), 1.0f);
+      }
+    });
+  }
+};
+}  // namespace imgr
+
+#endif  // !IMGR_HSV_IMAGE_H
@@ -18,35 +18,193 @@
 #  include <cstdint>
 #  include <iostream>
 #  include <string>
+#  include <type_traits>
+#  include <utility>
 #  include <vector>
 
+#  include "ImageView.h"
+#  include "PixelBuffer.h"
+#  include "parallel.h"
+#  include "simd/aligned_allocator.h"
+#  include "simd/hsv.h"
+#  include "simd/interleave.h"
 #  include "utils.h"
 
 namespace imgr {
 
+// Defined after Image, which it converts
+template <typename Pixel, typename Filter>
+void with_interleaved(const BasicImageView<Pixel>& view, bool parallel,
+                      Filter&& filter);
+
 struct Image {
   int m_width;
   int m_height;
   int m_channels;
-  std::vector<uint8_t> m_data;
+  PixelLayout m_layout;  // interleaved as loaded, see convert_layout
+  bool m_padded;         // rows start on cache lines, see allocate
+  PixelBuffer m_data;
   std::string m_name;
   std::string m_file_path;
 
-  Image() : m_width(0), m_height(0), m_channels(0), m_data(), m_name("") {}
+  Image()
+      : m_width(0),
+        m_height(0),
+        m_channels(0),
+        m_layout(PixelLayout::interleaved),
+        m_padded(false),
+        m_data(),
+        m_name("") {}
+
+  Image(const std::string& name) : Image() { load(name); }
+
+  // Copies the pixels but not the back buffer, which holds none of them
+  Image(const Image& other)
+      : m_width(other.m_width),
+        m_height(other.m_height),
+        m_channels(other.m_channels),
+        m_layout(other.m_layout),
+        m_padded(other.m_padded),
+        m_data(other.m_data),
+        m_name(other.m_name),
+        m_file_path(other.m_file_path) {}
+
+  // Leaves `other` empty
+  Image(Image&& other) noexcept : Image() { swap(other); }
+
+  // Copies the pixels of a view, e.g. to keep a crop of another image, in
+  // the view's layout
+  explicit Image(ConstImageView view) : Image() {
+    if (view.empty()) {
+      return;
+    }
+
+    m_width = view.width();
+    m_height = view.height();
+    m_channels = view.channels();
+    m_layout = view.layout();
+    m_data = PixelBuffer::uninitialized(static_cast<size_t>(m_width) *
+                                        m_height * m_channels);
+    copy_pixels(view, this->view());
+  }
 
-  Image(const std::string& name)
-      : m_width(0), m_height(0), m_channels(0), m_data(), m_name("") {
-    load(name);
+  // Replaces the pixels with width x height x channels unspecified ones in
+  // `layout`, keeping name and path. Rows are packed, or with `padded` each
+  // starts on a 64-byte line, so SIMD loads at a column are aligned the same
+  // on every row. Padding bytes are never read as pixels.
+  void allocate(int width, int height, int channels,
+                PixelLayout layout = PixelLayout::interleaved,
+                bool padded = false) {
+    m_width = width;
+    m_height = height;
+    m_channels = channels;
+    m_layout = channels == 1 ? PixelLayout::interleaved : layout;
+    m_padded = padded;
+    m_data = PixelBuffer::uninitialized(buffer_size(m_channels, m_layout));
+  }
+
+  // Bytes from one row to the next, of each plane when planar
+  size_t stride() const { return stride(m_channels, m_layout); }
+
+  // Same for this image's width and padding with other channels or layout,
+  // for filters that write a back buffer in that shape
+  size_t stride(int channels, PixelLayout layout) const {
+    const size_t bytes = static_cast<size_t>(m_width) *
+                         (layout == PixelLayout::planar ? 1 : channels);
+    return m_padded ? simd::padded_stride<uint8_t>(bytes) : bytes;
+  }
+
+  size_t buffer_size(int channels, PixelLayout layout) const {
+    return stride(channels, layout) * m_height *
+           (layout == PixelLayout::planar ? channels : 1);
+  }
+
+  // Row y, of the first plane when planar
+  uint8_t* row(int y) {
+    return m_data.data() + static_cast<size_t>(y) * stride();
+  }
+  const uint8_t* row(int y) const {
+    return m_data.data() + static_cast<size_t>(y) * stride();
   }
 
   void clear() {
     m_width = 0;
     m_height = 0;
     m_channels = 0;
-    m_data = {};
+    m_layout = PixelLayout::interleaved;
+    m_padded = false;
+    m_data.clear();
+    m_back.clear();
     m_name = "";
   }
 
+  void swap(Image& other) noexcept {
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_channels, other.m_channels);
+    std::swap(m_layout, other.m_layout);
+    std::swap(m_padded, other.m_padded);
+    m_data.swap(other.m_data);
+    m_name.swap(other.m_name);
+    m_file_path.swap(other.m_file_path);
+    m_back.swap(other.m_back);
+  }
+
+  // Filters that cannot work in place read m_data, write the result into
+  // back_buffer() and make it current with swap_buffers(). The old pixels
+  // then become the next back buffer, so a chain of filters on one image
+  // allocates it once. Contents are unspecified until written.
+  PixelBuffer& back_buffer(size_t size) {
+    if (m_back.size() != size) {
+      m_back = PixelBuffer::uninitialized(size);
+    }
+    return m_back;
+  }
+
+  void swap_buffers() noexcept { m_data.swap(m_back); }
+
+  // Rearranges the pixels into `layout`, one pass through the back buffer.
+  // A chain of filters that prefer planes converts once before the first
+  // and once after the last, instead of around each. Planar takes 2 to 4
+  // channels; 1-channel images are both and stay interleaved.
+  void convert_layout(PixelLayout layout, bool parallel = false) {
+    if (layout == m_layout || m_data.empty() || m_channels == 1) {
+      return;
+    }
+
+    if (m_channels > 4) {
+      std::cerr << "Planar layout needs 2 to 4 channels, got " << m_channels
+                << ".\n";
+      return;
+    }
+
+    PixelBuffer& output = back_buffer(buffer_size(m_channels, layout));
+    const size_t row_stride = stride(m_channels, layout);
+    const ImageView target =
+        layout == PixelLayout::planar
+            ? ImageView::planar(output.data(), m_width, m_height, m_channels,
+                                row_stride)
+            : ImageView(output.data(), m_width, m_height, m_channels,
+                        row_stride);
+    copy_pixels(view(), target, parallel);
+    swap_buffers();
+    m_layout = layout;
+  }
+
+  // The whole image, which is also what it converts to when passed to a
+  // filter, or a region of it
+  ImageView view() { return ImageView(*this); }
+  ConstImageView view() const { return ConstImageView(*this); }
+  ImageView view(int x, int y, int width, int height) {
+    return view().subview(x, y, width, height);
+  }
+  ConstImageView view(int x, int y, int width, int height) const {
+    return view().subview(x, y, width, height);
+  }
+
+  operator ImageView() { return view(); }
+  operator ConstImageView() const { return view(); }
+
   void print_stats() const {
     if (m_name.empty()) {
       std::cout << "Image: Is empty\n";
@@ -58,6 +216,9 @@ struct Image {
               << "\tWidth: " << m_width << "\n"
               << "\tHeight:" << m_height << "\n"
               << "\tChannels: " << m_channels << "\n"
+              << "\tLayout: "
+              << (m_layout == PixelLayout::planar ? "planar" : "interleaved")
+              << "\n"
               << "\tSupposed data size: " << m_width * m_height * m_channels
               << "\n"
               << "\tSize of m_data: " << m_data.size() << "\n";
@@ -86,11 +247,14 @@ struct Image {
       return;
     }
 
-    size_t full_size = m_width * m_height * m_channels;
-    m_data.clear();
-    m_data.reserve(full_size + 1);
-    copy(&loaded_data[0], &loaded_data[full_size], back_inserter(m_data));
-    delete[] loaded_data;
+    // The decoded pixels are kept where stb put them and freed by it
+    m_layout = PixelLayout::interleaved;
+    m_padded = false;
+    const size_t full_size =
+        static_cast<size_t>(m_width) * m_height * m_channels;
+    m_data = PixelBuffer::adopt(
+        loaded_data, full_size,
+        [](uint8_t* data, size_t) { stbi_image_free(data); });
   }
 
   void write(std::string path = "") {
@@ -121,12 +285,22 @@ struct Image {
 #  endif
     }
 
+    // The encoders take interleaved pixels, and the JPEG one packed rows
+    PixelBuffer interleaved;
+    const uint8_t* pixels = m_data.data();
+    if (m_layout == PixelLayout::planar || !view().contiguous()) {
+      interleaved = PixelBuffer::uninitialized(m_data.size());
+      copy_pixels(view(), ImageView(interleaved.data(), m_width, m_height,
+                                    m_channels));
+      pixels = interleaved.data();
+    }
+
     if (ends_with(path, ".png")) {
       int stride = m_width * m_channels;
-      stbi_write_png(path.c_str(), m_width, m_height, m_channels, m_data.data(),
+      stbi_write_png(path.c_str(), m_width, m_height, m_channels, pixels,
                      stride);
     } else if (ends_with(path, ".jpg") || ends_with(path, ".jpeg")) {
-      stbi_write_jpg(path.c_str(), m_width, m_height, m_channels, m_data.data(),
+      stbi_write_jpg(path.c_str(), m_width, m_height, m_channels, pixels,
                      100);
     } else {
       std::cerr << "Unsupported file type to write\n";
@@ -138,100 +312,191 @@ struct Image {
   }
 
   Image& operator=(const Image& other_img) {
-    m_width = other_img.m_width;
-    m_height = other_img.m_height;
-    m_channels = other_img.m_channels;
-    m_data = other_img.m_data;
-    m_name = other_img.m_name;
+    if (this != &other_img) {
+      m_width = other_img.m_width;
+      m_height = other_img.m_height;
+      m_channels = other_img.m_channels;
+      m_layout = other_img.m_layout;
+      m_padded = other_img.m_padded;
+      m_data = other_img.m_data;
+      m_name = other_img.m_name;
+      m_file_path = other_img.m_file_path;
+    }
 
     return *this;
   }
 
-  static void rgb_to_hsv(Image& image) {
-    if (image.m_data.empty()) {
-      std::cerr << "Empty image to convert to HSV!\n";
+  Image& operator=(Image&& other_img) noexcept {
+    Image taken(std::move(other_img));
+    swap(taken);
+
+    return *this;
+  }
+
+  // In place, as 8-bit HSV: H is hue * 255 / 360, so 0 and 255 are both
+  // red, and S and V are scaled to [0, 255]. Alpha is kept. Each call rounds
+  // to 8 bits; chains of HSV adjustments should go through HsvImage.
+  static void rgb_to_hsv(ImageView image, bool parallel = false) {
+    convert_hsv(image, true, parallel);
+  }
+
+  static void hsv_to_rgb(ImageView image, bool parallel = false) {
+    convert_hsv(image, false, parallel);
+  }
+
+  ~Image() = default;
+
+ private:
+  PixelBuffer m_back;
+
+  // Pixels per work item; the block's float planes stay in L2
+  static constexpr int kHsvBlockPixels = 1 << 13;
+
+  static void convert_hsv(ImageView image, bool to_hsv, bool parallel) {
+    if (image.empty()) {
+      std::cerr << (to_hsv ? "Empty image to convert to HSV!\n"
+                           : "Empty image to convert to RBG!\n");
       return;
     }
 
-    for (size_t i = 0; i < image.m_data.size(); i += 3) {
-      const double r_prime = static_cast<double>(image.m_data[i]) / 255.0f;
-      const double g_prime = static_cast<double>(image.m_data[i + 1]) / 255.0;
-      const double b_prime = static_cast<double>(image.m_data[i + 2]) / 255.0;
-      const double c_max = std::max({r_prime, g_prime, b_prime});
-      const double c_min = std::min({r_prime, g_prime, b_prime});
-      const double diff = c_max - c_min;
+    if (image.channels() < 3 || image.channels() > 4) {
+      std::cerr << "HSV needs an RGB or RGBA image, got "
+                << image.channels() << " channels.\n";
+      return;
+    }
 
-      double hue = 0.0;
-      double sat = (c_max == 0.0) ? 0.0 : (diff / c_max) * 100.0;
-      double val = c_max * 100.0;
+    if (image.planar()) {
+      with_interleaved(image, parallel, [&](ImageView pixels) {
+        convert_hsv(pixels, to_hsv, parallel);
+      });
+      return;
+    }
 
-      if (c_max == r_prime) {
-        hue = 60.0 * std::fmod((g_prime - b_prime) / diff, 6.0);
-      } else if (c_max == g_prime) {
-        hue = 60.0 * (b_prime - r_prime) / diff + 2.0;
-      } else if (c_max == b_prime) {
-        hue = 60.0 * (r_prime - g_prime) / diff + 4.0;
-      }
+    const int channels = image.channels();
+    const simd::PlaneScale rgb_scale = {1.0f / 255.0f, 1.0f / 255.0f,
+                                        1.0f / 255.0f};
+    const simd::PlaneScale hsv_scale = {360.0f / 255.0f, 1.0f / 255.0f,
+                                        1.0f / 255.0f};
+    const simd::PlaneScale& in_scale = to_hsv ? rgb_scale : hsv_scale;
+    const simd::PlaneScale out_scale =
+        to_hsv ? simd::PlaneScale{255.0f / 360.0f, 255.0f, 255.0f}
+               : simd::PlaneScale{255.0f, 255.0f, 255.0f};
+
+    // Float planes and alpha of a block, one set per thread
+    struct Scratch {
+      std::vector<float> planes;
+      std::vector<uint8_t> alpha;
+    };
+    const auto make_scratch = [&] {
+      return Scratch{std::vector<float>(size_t{kHsvBlockPixels} * 3),
+                     std::vector<uint8_t>(channels == 4 ? kHsvBlockPixels
+                                                        : 0)};
+    };
+
+    for_each_run(
+        image, kHsvBlockPixels, parallel, make_scratch,
+        [&](Scratch& scratch, int y, int x, int n) {
+          uint8_t* data = image.row(y) + x * channels;
+
+          float* const planes[3] = {scratch.planes.data(),
+                                    scratch.planes.data() + n,
+                                    scratch.planes.data() + 2 * n};
+          uint8_t* const alpha_plane =
+              scratch.alpha.empty() ? nullptr : scratch.alpha.data();
+
+          simd::deinterleave_row(data, n, channels, in_scale, planes,
+                                 alpha_plane);
+          if (to_hsv) {
+            simd::rgb_to_hsv(planes, n);
+          } else {
+            simd::hsv_to_rgb(planes, n);
+          }
+          simd::interleave_row(planes, alpha_plane, n, channels, out_scale,
+                               data);
+        });
+  }
+};
 
-      if (hue < 0) hue += 360.0;
+// Input and output of a filter whose output pixels read neighbouring input
+// pixels, so it cannot overwrite its input as it goes. On a whole Image the
+// output is the back buffer, swapped in by finish(). On a region the input
+// is first copied to a pooled buffer and the output goes through the view.
+// Views are interleaved, or one plane of a planar image.
+class OutOfPlace {
+ public:
+  explicit OutOfPlace(ImageView view) : m_image(view.image()) {
+    const int width = view.width();
+    const int height = view.height();
+    const int channels = view.channels();
+
+    if (m_image != nullptr) {
+      PixelBuffer& output = m_image->back_buffer(m_image->m_data.size());
+      const size_t stride = m_image->stride();
+      m_source = ConstImageView(m_image->m_data.data(), width, height,
+                                channels, stride);
+      m_target = ImageView(output.data(), width, height, channels, stride);
+      return;
+    }
 
-      image.m_data[i] = static_cast<uint8_t>(hue);
-      image.m_data[i + 1] = static_cast<uint8_t>(sat);
-      image.m_data[i + 2] = static_cast<uint8_t>(val);
+    const size_t row_bytes = view.row_bytes();
+    m_copy = PixelBuffer::uninitialized(row_bytes * height);
+    for (int y = 0; y < height; ++y) {
+      std::copy_n(view.row(y), row_bytes, m_copy.data() + y * row_bytes);
     }
+    m_source = ConstImageView(m_copy.data(), width, height, channels);
+    m_target = view;
   }
 
-  static void hsv_to_rgb(Image& image) {
-    if (image.m_data.empty()) {
-      std::cerr << "Empty image to convert to RBG!\n";
-      return;
+  const ConstImageView& source() const { return m_source; }
+  const ImageView& target() const { return m_target; }
+
+  // Call once every output pixel is written
+  void finish() {
+    if (m_image != nullptr) {
+      m_image->swap_buffers();
     }
+  }
 
-    for (size_t i = 0; i < image.m_data.size(); i += 3) {
-      const double hue = static_cast<double>(image.m_data[i]);
-      const double sat = static_cast<double>(image.m_data[i + 1]);
-      const double val = static_cast<double>(image.m_data[i + 2]);
-
-      const double c = val * sat;
-      const double x = c * (1 - std::abs(std::fmod(hue / 60.0, 2.0) - 1));
-      const double m = val - c;
-
-      double r_prime = 0.0;
-      double g_prime = 0.0;
-      double b_prime = 0.0;
-
-      if (hue >= 0.0 && hue < 60.0) {
-        r_prime = c;
-        g_prime = x;
-      } else if (hue >= 60.0 && hue < 120.0) {
-        r_prime = x;
-        g_prime = c;
-      } else if (hue >= 120.0 && hue < 180.0) {
-        g_prime = c;
-        b_prime = x;
-      } else if (hue >= 180.0 && hue < 240.0) {
-        g_prime = x;
-        b_prime = c;
-      } else if (hue >= 240.0 && hue < 300.0) {
-        r_prime = x;
-        b_prime = c;
-      } else if (hue >= 300.0 && hue < 360.0) {
-        r_prime = c;
-        b_prime = x;
-      }
-
-      const uint8_t r = static_cast<uint8_t>((r_prime + m) * 255.0);
-      const uint8_t g = static_cast<uint8_t>((g_prime + m) * 255.0);
-      const uint8_t b = static_cast<uint8_t>((b_prime + m) * 255.0);
-
-      image.m_data[i] = r;
-      image.m_data[i + 1] = g;
-      image.m_data[i + 2] = b;
-    }
-  }
-
-  ~Image() {}
+ private:
+  Image* m_image;
+  PixelBuffer m_copy;
+  ConstImageView m_source;
+  ImageView m_target;
 };
+
+// Runs filter(view) on interleaved pixels, for filters that read all
+// channels of a pixel together. A planar image is converted there and back,
+// so it keeps its layout. A planar region is interleaved into a pooled copy,
+// filtered there and, unless read-only, split back into its planes.
+template <typename Pixel, typename Filter>
+inline void with_interleaved(const BasicImageView<Pixel>& view, bool parallel,
+                             Filter&& filter) {
+  if (!view.planar()) {
+    filter(view);
+    return;
+  }
+
+  if constexpr (!std::is_const_v<Pixel>) {
+    if (Image* image = view.image()) {
+      image->convert_layout(PixelLayout::interleaved, parallel);
+      filter(view);
+      image->convert_layout(PixelLayout::planar, parallel);
+      return;
+    }
+  }
+
+  const int width = view.width();
+  const int height = view.height();
+  const int channels = view.channels();
+  PixelBuffer copy = PixelBuffer::uninitialized(static_cast<size_t>(width) *
+                                                height * channels);
+  const ImageView interleaved(copy.data(), width, height, channels);
+  copy_pixels(view, interleaved, parallel);
+  filter(BasicImageView<Pixel>(interleaved));
+  if constexpr (!std::is_const_v<Pixel>) {
+    copy_pixels(interleaved, view, parallel);
+  }
+}
 }  // namespace imgr
 
 #endif  // !IMGR_IMAGE_H
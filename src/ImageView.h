@@ -0,0 +1,305 @@
+#pragma once
+
+#ifndef IMGR_IMAGE_VIEW_H
+#  define IMGR_IMAGE_VIEW_H
+
+#  include <algorithm>
+#  include <cstddef>
+#  include <cstdint>
+#  include <iostream>
+#  include <type_traits>
+
+#  include "parallel.h"
+#  include "simd/interleave.h"
+
+namespace imgr {
+struct Image;
+
+// Where the samples of a pixel are
+enum class PixelLayout {
+  interleaved = 0,  // RGBRGB..., as files are decoded and encoded
+  planar,           // a width x height plane per channel, RR..GG..BB..
+};
+
+// Non-owning window onto 8-bit pixels: width x height pixels of `channels`
+// samples, rows `stride` bytes apart. Filters take views, so a crop, a tile
+// or a region of interest is processed in place without being copied out.
+// A filter treats the view as the whole image: borders are at its edges and
+// pixels outside it are never read.
+//
+// Samples are interleaved, or with 2 to 4 channels may be planar: one plane
+// per channel, `plane_stride` bytes apart, whose rows hold that channel's
+// samples only. Filters that never mix channels run plane by plane on
+// planar views; the others see them interleaved (see with_interleaved).
+//
+// A view of a whole Image follows the image rather than its current buffer,
+// so it stays valid when a filter swaps in the back buffer or changes the
+// channel count. Subviews and views of other memory hold a plain pointer,
+// which such a swap of the image underneath leaves on the old pixels.
+template <typename Pixel>  // uint8_t, or const uint8_t for read-only views
+class BasicImageView {
+ public:
+  using Owner =
+      std::conditional_t<std::is_const_v<Pixel>, const Image, Image>;
+
+  BasicImageView() noexcept
+      : m_data(nullptr),
+        m_width(0),
+        m_height(0),
+        m_channels(0),
+        m_stride(0),
+        m_plane_stride(0),
+        m_image(nullptr) {}
+
+  // Rows are packed unless a stride, in bytes, is given
+  BasicImageView(Pixel* data, int width, int height, int channels,
+                 size_t stride = 0) noexcept
+      : m_data(data),
+        m_width(width),
+        m_height(height),
+        m_channels(channels),
+        m_stride(stride != 0 ? stride
+                             : static_cast<size_t>(width) * channels),
+        m_plane_stride(0),
+        m_image(nullptr) {}
+
+  // Planes of packed rows, one after the other, unless strides are given
+  static BasicImageView planar(Pixel* data, int width, int height,
+                               int channels, size_t stride = 0,
+                               size_t plane_stride = 0) noexcept {
+    BasicImageView view(data, width, height, channels,
+                        stride != 0 ? stride : static_cast<size_t>(width));
+    if (channels > 1) {
+      view.m_plane_stride =
+          plane_stride != 0 ? plane_stride : view.m_stride * height;
+    }
+    return view;
+  }
+
+  explicit BasicImageView(Owner& image) noexcept : BasicImageView() {
+    m_image = &image;
+  }
+
+  // Any view can be read through
+  template <typename Other,
+            typename = std::enable_if_t<std::is_same_v<const Other, Pixel> &&
+                                        !std::is_same_v<Other, Pixel>>>
+  BasicImageView(const BasicImageView<Other>& other) noexcept
+      : m_data(other.m_data),
+        m_width(other.m_width),
+        m_height(other.m_height),
+        m_channels(other.m_channels),
+        m_stride(other.m_stride),
+        m_plane_stride(other.m_plane_stride),
+        m_image(other.m_image) {}
+
+  Pixel* data() const {
+    return m_image != nullptr ? m_image->m_data.data() : m_data;
+  }
+  int width() const { return m_image != nullptr ? m_image->m_width : m_width; }
+  int height() const {
+    return m_image != nullptr ? m_image->m_height : m_height;
+  }
+  int channels() const {
+    return m_image != nullptr ? m_image->m_channels : m_channels;
+  }
+  size_t stride() const {
+    return m_image != nullptr ? m_image->stride() : m_stride;
+  }
+  // 0 when interleaved
+  size_t plane_stride() const {
+    if (m_image == nullptr) {
+      return m_plane_stride;
+    }
+    return m_image->m_layout == PixelLayout::planar
+               ? m_image->stride() * height()
+               : 0;
+  }
+
+  bool planar() const { return plane_stride() != 0; }
+  PixelLayout layout() const {
+    return planar() ? PixelLayout::planar : PixelLayout::interleaved;
+  }
+
+  // The Image this view covers whole, or null
+  Owner* image() const { return m_image; }
+
+  // Bytes from one pixel of a row to the next
+  int sample_step() const { return planar() ? 1 : channels(); }
+  size_t row_bytes() const {
+    return static_cast<size_t>(width()) * sample_step();
+  }
+  bool empty() const {
+    return data() == nullptr || width() <= 0 || height() <= 0;
+  }
+  // No gaps between rows, so the pixels are one run
+  bool contiguous() const { return stride() == row_bytes(); }
+
+  // Row y, of the first plane when planar
+  Pixel* row(int y) const { return data() + static_cast<size_t>(y) * stride(); }
+
+  // Channel c of a planar view as a 1-channel view; a 1-channel view is its
+  // own plane
+  BasicImageView plane(int c) const {
+    return BasicImageView(data() + c * plane_stride(), width(), height(), 1,
+                          stride());
+  }
+
+  // Pixels [x, x + width) x [y, y + height) of this view, in the same memory.
+  // Empty, with an error, when the region does not fit.
+  BasicImageView subview(int x, int y, int width, int height) const {
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        x + width > this->width() || y + height > this->height()) {
+      std::cerr << "Region " << width << "x" << height << " at (" << x << ", "
+                << y << ") is outside the " << this->width() << "x"
+                << this->height() << " image.\n";
+      return BasicImageView();
+    }
+
+    if (width == this->width() && height == this->height()) {
+      return *this;
+    }
+    BasicImageView region(row(y) + static_cast<size_t>(x) * sample_step(),
+                          width, height, channels(), stride());
+    region.m_plane_stride = plane_stride();
+    return region;
+  }
+
+ private:
+  template <typename>
+  friend class BasicImageView;
+
+  Pixel* m_data;
+  int m_width;
+  int m_height;
+  int m_channels;
+  size_t m_stride;
+  size_t m_plane_stride;
+  Owner* m_image;
+};
+
+using ImageView = BasicImageView<uint8_t>;
+using ConstImageView = BasicImageView<const uint8_t>;
+
+namespace detail {
+// How for_each_run cuts a view: `count` runs, run i at (y, x) of n pixels
+struct Runs {
+  int width;
+  int block;
+  bool contiguous;
+  size_t pixels;
+  int count;
+
+  template <typename Pixel>
+  Runs(const BasicImageView<Pixel>& view, int block)
+      : width(view.width()),
+        block(block),
+        contiguous(view.contiguous()),
+        pixels(static_cast<size_t>(view.width()) * view.height()) {
+    const int per_row = (width + block - 1) / block;
+    count = contiguous ? static_cast<int>((pixels + block - 1) / block)
+                       : view.height() * per_row;
+  }
+
+  template <typename Body>
+  void run(int i, Body&& body) const {
+    if (contiguous) {
+      const size_t first = static_cast<size_t>(i) * block;
+      body(static_cast<int>(first / width), static_cast<int>(first % width),
+           static_cast<int>(std::min<size_t>(block, pixels - first)));
+      return;
+    }
+    const int per_row = (width + block - 1) / block;
+    const int x = (i % per_row) * block;
+    body(i / per_row, x, std::min(block, width - x));
+  }
+};
+}  // namespace detail
+
+// Calls body(y, x, count) for runs of at most `block` pixels that are each
+// contiguous in memory and together cover the view: packed rows are cut as
+// one long row, strided ones row by row. For per-pixel work, which cares
+// neither where rows end nor in what order the runs come. On planar views a
+// run covers the same pixels in every plane.
+template <typename Pixel, typename Body>
+inline void for_each_run(const BasicImageView<Pixel>& view, int block,
+                         bool parallel, Body&& body) {
+  const detail::Runs runs(view, block);
+  parallel_for_rows(0, runs.count, parallel,
+                    [&](int i) { runs.run(i, body); });
+}
+
+// Same runs, for work that needs a buffer per block: each thread makes one
+// scratch = make_scratch() and calls body(scratch, y, x, count) with it for
+// every run it takes
+template <typename Pixel, typename MakeScratch, typename Body>
+inline void for_each_run(const BasicImageView<Pixel>& view, int block,
+                         bool parallel, MakeScratch&& make_scratch,
+                         Body&& body) {
+  const detail::Runs runs(view, block);
+#  pragma omp parallel if (parallel)
+  {
+    auto scratch = make_scratch();
+#  pragma omp for schedule(dynamic, 8)
+    for (int i = 0; i < runs.count; ++i) {
+      runs.run(i, [&](int y, int x, int count) {
+        body(scratch, y, x, count);
+      });
+    }
+  }
+}
+
+// Calls body(plane) with each channel of a planar view as a 1-channel view,
+// or once with the view itself when it is interleaved. For filters that
+// never mix channels, which then see the samples of one channel back to
+// back.
+template <typename Pixel, typename Body>
+inline void for_each_plane(const BasicImageView<Pixel>& view, Body&& body) {
+  if (!view.planar()) {
+    body(view);
+    return;
+  }
+  for (int c = 0; c < view.channels(); ++c) {
+    body(view.plane(c));
+  }
+}
+
+// Copies the pixels of `from` into `to`, of the same size and channel
+// count, converting between layouts on the way
+inline void copy_pixels(ConstImageView from, ImageView to,
+                        bool parallel = false) {
+  const int width = from.width();
+  const int height = from.height();
+  const int channels = from.channels();
+
+  if (from.planar() == to.planar()) {
+    const int planes = from.planar() ? channels : 1;
+    const size_t row_bytes = from.row_bytes();
+    parallel_for_rows(0, planes * height, parallel, [&](int i) {
+      const int y = i % height;
+      const size_t plane = static_cast<size_t>(i / height);
+      std::copy_n(from.row(y) + plane * from.plane_stride(), row_bytes,
+                  to.row(y) + plane * to.plane_stride());
+    });
+    return;
+  }
+
+  parallel_for_rows(0, height, parallel, [&](int y) {
+    if (to.planar()) {
+      uint8_t* planes[4];
+      for (int c = 0; c < channels; ++c) {
+        planes[c] = to.row(y) + c * to.plane_stride();
+      }
+      simd::split_row(from.row(y), width, channels, planes);
+    } else {
+      const uint8_t* planes[4];
+      for (int c = 0; c < channels; ++c) {
+        planes[c] = from.row(y) + c * from.plane_stride();
+      }
+      simd::merge_row(planes, width, channels, to.row(y));
+    }
+  });
+}
+}  // namespace imgr
+
+#endif  // !IMGR_IMAGE_VIEW_H
@@ -0,0 +1,162 @@
+#pragma once
+
+#ifndef IMGR_PIXEL_BUFFER_H
+#  define IMGR_PIXEL_BUFFER_H
+
+#  include <algorithm>
+#  include <cstddef>
+#  include <cstdint>
+#  include <utility>
+
+#  include "BufferPool.h"
+
+namespace imgr {
+// Owning storage for pixel bytes with the accessors filters use on
+// std::vector (data, size, operator[], begin/end, resize, assign, swap).
+// Its own memory comes from the BufferPool, 64-byte aligned and reused
+// between images. It can also adopt memory it did not allocate, freed through
+// the deleter given with it, e.g. the decoder's buffer with stbi_image_free,
+// so a decoded image is never copied.
+class PixelBuffer {
+ public:
+  // Called with the block and the capacity it was allocated with
+  using Deleter = void (*)(uint8_t* data, size_t capacity);
+
+  PixelBuffer() noexcept
+      : m_data(nullptr), m_size(0), m_capacity(0), m_deleter(nullptr) {}
+
+  explicit PixelBuffer(size_t size, uint8_t value = 0) : PixelBuffer() {
+    assign(size, value);
+  }
+
+  PixelBuffer(const PixelBuffer& other) : PixelBuffer() {
+    allocate(other.m_size);
+    std::copy_n(other.data(), m_size, data());
+  }
+
+  PixelBuffer(PixelBuffer&& other) noexcept : PixelBuffer() { swap(other); }
+
+  PixelBuffer& operator=(const PixelBuffer& other) {
+    if (this != &other) {
+      PixelBuffer copy(other);
+      swap(copy);
+    }
+    return *this;
+  }
+
+  PixelBuffer& operator=(PixelBuffer&& other) noexcept {
+    PixelBuffer taken(std::move(other));
+    swap(taken);
+    return *this;
+  }
+
+  ~PixelBuffer() { release(); }
+
+  // For buffers that are fully written before being read, skipping the
+  // zero fill, so a reused pool block is not touched twice
+  static PixelBuffer uninitialized(size_t size) {
+    PixelBuffer buffer;
+    buffer.allocate(size);
+    return buffer;
+  }
+
+  // Takes ownership of `size` bytes at `data`, released with `deleter`
+  static PixelBuffer adopt(uint8_t* data, size_t size, Deleter deleter) {
+    PixelBuffer buffer;
+    if (data != nullptr) {
+      buffer.m_data = data;
+      buffer.m_size = size;
+      buffer.m_capacity = size;
+      buffer.m_deleter = deleter;
+    }
+    return buffer;
+  }
+
+  uint8_t* data() noexcept { return m_data; }
+  const uint8_t* data() const noexcept { return m_data; }
+  size_t size() const noexcept { return m_size; }
+  size_t capacity() const noexcept { return m_capacity; }
+  bool empty() const noexcept { return m_size == 0; }
+
+  uint8_t& operator[](size_t i) noexcept { return m_data[i]; }
+  const uint8_t& operator[](size_t i) const noexcept { return m_data[i]; }
+
+  uint8_t* begin() noexcept { return m_data; }
+  uint8_t* end() noexcept { return m_data + m_size; }
+  const uint8_t* begin() const noexcept { return m_data; }
+  const uint8_t* end() const noexcept { return m_data + m_size; }
+
+  // As std::vector::resize: the first bytes are kept, new ones are zero
+  void resize(size_t size) {
+    if (size > m_capacity) {
+      PixelBuffer grown = uninitialized(size);
+      std::copy_n(m_data, m_size, grown.m_data);
+      grown.m_size = m_size;
+      swap(grown);
+    }
+    if (size > m_size) {
+      std::fill(m_data + m_size, m_data + size, uint8_t{0});
+    }
+    m_size = size;
+  }
+
+  void assign(size_t size, uint8_t value) {
+    if (size > m_capacity) {
+      release();
+      allocate(size);
+    }
+    m_size = size;
+    std::fill_n(m_data, m_size, value);
+  }
+
+  void clear() noexcept { release(); }
+
+  void swap(PixelBuffer& other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_deleter, other.m_deleter);
+  }
+
+  // Same bytes, wherever they are stored
+  friend bool operator==(const PixelBuffer& a, const PixelBuffer& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+  }
+
+  friend bool operator!=(const PixelBuffer& a, const PixelBuffer& b) {
+    return !(a == b);
+  }
+
+ private:
+  static void pool_release(uint8_t* data, size_t capacity) {
+    BufferPool::instance().release(data, capacity);
+  }
+
+  // Expects an empty buffer
+  void allocate(size_t size) {
+    if (size == 0) {
+      return;
+    }
+    m_data = BufferPool::instance().allocate(size, m_capacity);
+    m_size = size;
+    m_deleter = pool_release;
+  }
+
+  void release() noexcept {
+    if (m_data != nullptr) {
+      m_deleter(m_data, m_capacity);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+    m_deleter = nullptr;
+  }
+
+  uint8_t* m_data;
+  size_t m_size;
+  size_t m_capacity;
+  Deleter m_deleter;
+};
+}  // namespace imgr
+
+#endif  // !IMGR_PIXEL_BUFFER_H
@@ -0,0 +1,324 @@
+#pragma once
+
+#ifndef IMGR_FILTER_ANISOTROPIC_KUWAHARA_H
+#  define IMGR_FILTER_ANISOTROPIC_KUWAHARA_H
+
+#  include <omp.h>
+
+#  include <algorithm>
+#  include <cmath>
+#  include <iostream>
+#  include <vector>
+
+#  include "../Image.h"
+#  include "../parallel.h"
+#  include "Border.h"
+#  include "GaussianBlur.h"
+
+namespace imgr {
+// Anisotropic Kuwahara filter (Kyprianidis, Kang and Doellner, "Image and
+// video abstraction by anisotropic Kuwahara filtering", 2009, with the
+// polynomial sector weights of Kyprianidis et al. 2010). The square regions
+// of KuwaharaFilter become eight overlapping, smoothly weighted sectors of an
+// ellipse that follows the local orientation, so edges and strokes keep
+// their direction instead of turning blocky.
+class AnisotropicKuwahara {
+ public:
+  // window_size is the diameter of the filter disk before it is stretched
+  // into an ellipse; sharpness is q, how strongly low-variance sectors win
+  static void apply_anisotropic_kuwahara(
+      ImageView image, int window_size = 13,
+      BorderMode border = BorderMode::clamp, float sharpness = 8.0f) {
+    run(image, window_size, border, sharpness, false);
+  }
+
+  static void apply_anisotropic_kuwahara_parallel(
+      ImageView image, int window_size = 13,
+      BorderMode border = BorderMode::clamp, float sharpness = 8.0f) {
+    run(image, window_size, border, sharpness, true);
+  }
+
+  // Reads whole pixels, so planar images are interleaved for it and back
+  static PixelLayout preferred_layout() { return PixelLayout::interleaved; }
+
+ private:
+  static constexpr int kSectors = 8;
+  static constexpr int kMaxChannels = 4;
+  static constexpr int kTileSize = 32;
+  static constexpr float kTensorSigma = 2.0f;
+  // Eccentricity tuning: 1 lets the ellipse stretch up to twice the radius
+  static constexpr float kAlpha = 1.0f;
+
+  static void run(ImageView image, int window_size, BorderMode border,
+                  float sharpness, bool parallel) {
+    if (window_size < 3 || window_size % 2 == 0) {
+      std::cerr << "Invalid winsize " << window_size
+                << ": winsize must be an odd number from 3 up.\n";
+      return;
+    }
+
+    if (image.channels() < 1 || image.channels() > kMaxChannels) {
+      std::cerr << "Image must have 1 to " << kMaxChannels
+                << " channels to process.\n";
+      return;
+    }
+
+    if (image.planar()) {
+      with_interleaved(image, parallel, [&](ImageView pixels) {
+        run(pixels, window_size, border, sharpness, parallel);
+      });
+      return;
+    }
+
+    const std::vector<float> tensor = structure_tensor(image, border, parallel);
+    filter(image, tensor, window_size / 2, border, sharpness, parallel);
+  }
+
+  // Gray, gray + alpha, RGB or RGBA: alpha is filtered but does not steer
+  static int color_channels(int channels) { return channels >= 3 ? 3 : 1; }
+
+  // Per pixel (E, F, G) = sum over colour channels of (fx^2, fx*fy, fy^2)
+  // from Sobel derivatives, smoothed with the separable Gaussian so the
+  // orientation is stable over a neighbourhood
+  static std::vector<float> structure_tensor(ConstImageView image,
+                                             BorderMode border,
+                                             bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+    const int colors = color_channels(channels);
+    const Image padded = pad_image(image, 1, border, parallel);
+    const int padded_stride = padded.m_width * channels;
+
+    std::vector<float> tensor(static_cast<size_t>(width) * height * 3);
+
+    parallel_for_rows(0, height, parallel, [&](int y) {
+      const uint8_t* above =
+          padded.m_data.data() + static_cast<size_t>(y) * padded_stride;
+      const uint8_t* middle = above + padded_stride;
+      const uint8_t* below = middle + padded_stride;
+      float* out = tensor.data() + static_cast<size_t>(y) * width * 3;
+
+      for (int x = 0; x < width; ++x) {
+        float e = 0.0f;
+        float f = 0.0f;
+        float g = 0.0f;
+
+        for (int c = 0; c < colors; ++c) {
+          const int l = x * channels + c;
+          const int m = l + channels;
+          const int r = m + channels;
+          const float fx = ((above[r] + 2.0f * middle[r] + below[r]) -
+                            (above[l] + 2.0f * middle[l] + below[l])) /
+                           (4.0f * 255.0f);
+          const float fy = ((below[l] + 2.0f * below[m] + below[r]) -
+                            (above[l] + 2.0f * above[m] + above[r])) /
+                           (4.0f * 255.0f);
+          e += fx * fx;
+          f += fx * fy;
+          g += fy * fy;
+        }
+
+        out[x * 3] = e;
+        out[x * 3 + 1] = f;
+        out[x * 3 + 2] = g;
+      }
+    });
+
+    const int kernel_size =
+        static_cast<int>(2 * std::ceil(3 * kTensorSigma) + 1);
+    if (parallel) {
+      GaussianBlur::apply_gaussian_blur_float_parallel(
+          tensor.data(), width, height, 3, kTensorSigma, kernel_size, border);
+    } else {
+      GaussianBlur::apply_gaussian_blur_float(tensor.data(), width, height, 3,
+                                              kTensorSigma, kernel_size,
+                                              border);
+    }
+
+    return tensor;
+  }
+
+  static void filter(ImageView image, const std::vector<float>& tensor,
+                     int radius, BorderMode border, float sharpness,
+                     bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+    const int colors = color_channels(channels);
+
+    // The ellipse's long semi-axis is at most (1 + 1 / alpha) * radius
+    const int margin =
+        static_cast<int>(std::ceil(radius * (kAlpha + 1.0f) / kAlpha));
+    const Image padded = pad_image(image, margin, border, parallel);
+    const int padded_stride = padded.m_width * channels;
+
+    // Sector weight polynomial: overlap at the centre, and the curvature
+    // that makes neighbouring sectors meet at the sector boundaries
+    const float pi = 3.14159265358979f;
+    const float zeta = 2.0f / radius;
+    const float eta = (zeta + std::cos(pi / kSectors)) /
+                      (std::sin(pi / kSectors) * std::sin(pi / kSectors));
+    const float half_sqrt2 = 0.70710678f;
+
+    const int tiles_x = (width + kTileSize - 1) / kTileSize;
+    const int tiles_y = (height + kTileSize - 1) / kTileSize;
+
+    parallel_for_rows(0, tiles_x * tiles_y, parallel, [&](int tile) {
+      const int x0 = (tile % tiles_x) * kTileSize;
+      const int y0 = (tile / tiles_x) * kTileSize;
+      const int x1 = std::min(x0 + kTileSize, width);
+      const int y1 = std::min(y0 + kTileSize, height);
+
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+          const float* t =
+              tensor.data() + (static_cast<size_t>(y) * width + x) * 3;
+          const float e = t[0];
+          const float f = t[1];
+          const float g = t[2];
+
+          // Minor eigenvector of the tensor is the direction of least
+          // change, along edges; the eigenvalue spread gives how
+          // anisotropic the neighbourhood is
+          const float root = std::sqrt((e - g) * (e - g) + 4.0f * f * f);
+          const float lambda1 = 0.5f * (e + g + root);
+          const float lambda2 = 0.5f * (e + g - root);
+          float tx = lambda1 - e;
+          float ty = -f;
+          const float length = std::sqrt(tx * tx + ty * ty);
+          if (length > 0.0f) {
+            tx /= length;
+            ty /= length;
+          } else {
+            // F = 0 and E >= G: the gradient is along x, edges along y
+            tx = 0.0f;
+            ty = 1.0f;
+          }
+          const float anisotropy = lambda1 + lambda2 > 0.0f
+                                       ? (lambda1 - lambda2) /
+                                             (lambda1 + lambda2)
+                                       : 0.0f;
+
+          // Ellipse semi-axes, and the map from an offset to the disk of
+          // radius 0.5 the sector weights are defined on
+          const float a = radius * (kAlpha + anisotropy) / kAlpha;
+          const float b = radius * kAlpha / (kAlpha + anisotropy);
+          const float cos_phi = tx;
+          const float sin_phi = ty;
+          const int extent_x = std::min(
+              margin, static_cast<int>(std::ceil(std::sqrt(
+                          a * a * cos_phi * cos_phi +
+                          b * b * sin_phi * sin_phi))));
+          const int extent_y = std::min(
+              margin, static_cast<int>(std::ceil(std::sqrt(
+                          a * a * sin_phi * sin_phi +
+                          b * b * cos_phi * cos_phi))));
+
+          alignas(32) float weight_sums[kSectors] = {};
+          alignas(32) float means[kMaxChannels][kSectors] = {};
+          alignas(32) float squares[kMaxChannels][kSectors] = {};
+
+          for (int j = -extent_y; j <= extent_y; ++j) {
+            const uint8_t* row =
+                padded.m_data.data() +
+                static_cast<size_t>(y + margin + j) * padded_stride +
+                static_cast<size_t>(x + margin) * channels;
+
+            for (int i = -extent_x; i <= extent_x; ++i) {
+              const float vx = 0.5f * (cos_phi * i + sin_phi * j) / a;
+              const float vy = 0.5f * (-sin_phi * i + cos_phi * j) / b;
+              const float distance = vx * vx + vy * vy;
+              if (distance > 0.25f) {
+                continue;
+              }
+
+              alignas(32) float w[kSectors];
+              sector_weights(vx, vy, zeta, eta, half_sqrt2, w);
+
+              float total = 0.0f;
+              for (int k = 0; k < kSectors; ++k) {
+                total += w[k];
+              }
+              if (total <= 0.0f) {
+                continue;
+              }
+              const float gauss = std::exp(-3.125f * distance) / total;
+
+              const uint8_t* sample = row + i * channels;
+#  pragma omp simd
+              for (int k = 0; k < kSectors; ++k) {
+                w[k] *= gauss;
+                weight_sums[k] += w[k];
+              }
+              for (int c = 0; c < channels; ++c) {
+                const float value = sample[c] * (1.0f / 255.0f);
+                const float value_squared = value * value;
+#  pragma omp simd
+                for (int k = 0; k < kSectors; ++k) {
+                  means[c][k] += value * w[k];
+                  squares[c][k] += value_squared * w[k];
+                }
+              }
+            }
+          }
+
+          // Sectors with low variance dominate the blend
+          float result[kMaxChannels] = {};
+          float total_weight = 0.0f;
+          for (int k = 0; k < kSectors; ++k) {
+            const float inverse = 1.0f / weight_sums[k];
+            float variance = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+              means[c][k] *= inverse;
+              if (c < colors) {
+                variance += std::abs(squares[c][k] * inverse -
+                                     means[c][k] * means[c][k]);
+              }
+            }
+
+            const float weight =
+                1.0f / (1.0f + std::pow(255.0f * variance, 0.5f * sharpness));
+            total_weight += weight;
+            for (int c = 0; c < channels; ++c) {
+              result[c] += weight * means[c][k];
+            }
+          }
+
+          uint8_t* dst = image.row(y) + x * channels;
+          for (int c = 0; c < channels; ++c) {
+            const float value = 255.0f * result[c] / total_weight + 0.5f;
+            dst[c] =
+                static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value)));
+          }
+        }
+      }
+    });
+  }
+
+  // Weights of the eight sectors at (vx, vy) in the unit-disk frame: four
+  // parabolas along the axes, then the same four rotated by 45 degrees
+  static void sector_weights(float vx, float vy, float zeta, float eta,
+                             float half_sqrt2, float* w) {
+    auto square = [](float z) { return z > 0.0f ? z * z : 0.0f; };
+
+    float xx = zeta - eta * vx * vx;
+    float yy = zeta - eta * vy * vy;
+    w[0] = square(vy + xx);
+    w[2] = square(-vx + yy);
+    w[4] = square(-vy + xx);
+    w[6] = square(vx + yy);
+
+    const float rx = half_sqrt2 * (vx - vy);
+    const float ry = half_sqrt2 * (vx + vy);
+    xx = zeta - eta * rx * rx;
+    yy = zeta - eta * ry * ry;
+    w[1] = square(ry + xx);
+    w[3] = square(-rx + yy);
+    w[5] = square(-ry + xx);
+    w[7] = square(rx + yy);
+  }
+};
+}  // namespace imgr
+
+#endif  // !IMGR_FILTER_ANISOTROPIC_KUWAHARA_H
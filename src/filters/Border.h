@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef IMGR_FILTER_BORDER_H
+#  define IMGR_FILTER_BORDER_H
+
+#  include <cstdint>
+#  include <vector>
+
+#  include "../Image.h"
+
+namespace imgr {
+// How samples outside the image are made up
+enum class BorderMode {
+  clamp = 0,  // aaa|abcd|ddd
+  mirror,     // cb|abcd|cb, the edge pixel is not repeated
+  wrap,       // cd|abcd|ab
+  constant,   // 00|abcd|00
+};
+
+// Maps coordinates in [-radius, size + radius) to a source coordinate, or to
+// -1 where the constant border applies. Filters look indices up here once per
+// row or column instead of clamping on every tap.
+struct BorderTable {
+  int size;
+  int radius;
+  std::vector<int> index;
+
+  int operator()(int i) const { return index[i + radius]; }
+};
+
+inline int border_index(int i, int size, BorderMode mode) {
+  if (i >= 0 && i < size) {
+    return i;
+  }
+
+  switch (mode) {
+  case BorderMode::mirror: {
+    if (size == 1) {
+      return 0;
+    }
+    // Reflection is periodic with period 2 * (size - 1)
+    const int period = 2 * (size - 1);
+    i = ((i % period) + period) % period;
+    return i < size ? i : period - i;
+  }
+  case BorderMode::wrap:     return ((i % size) + size) % size;
+  case BorderMode::constant: return -1;
+  case BorderMode::clamp:
+  default:                   return i < 0 ? 0 : size - 1;
+  }
+}
+
+inline BorderTable make_border_table(int size, int radius, BorderMode mode) {
+  BorderTable table{size, radius, std::vector<int>(size + 2 * radius)};
+
+  for (int i = -radius; i < size + radius; ++i) {
+    table.index[i + radius] = border_index(i, size, mode);
+  }
+
+  return table;
+}
+
+// Copies one row of interleaved samples into `dst` with columns.radius border
+// pixels on both sides. The interior is a plain conversion loop; only the
+// 2 * radius border pixels go through the table.
+template <typename S, typename T>
+inline void pad_row(const S* src, int channels, const BorderTable& columns,
+                    T* dst) {
+  const int width = columns.size;
+  const int radius = columns.radius;
+  const int stride = width * channels;
+  T* inner = dst + radius * channels;
+
+  for (int i = 0; i < stride; ++i) {
+    inner[i] = src[i];
+  }
+
+  auto fill_pixel = [&](int x) {
+    const int source = columns(x);
+    T* out = dst + (x + radius) * channels;
+    for (int c = 0; c < channels; ++c) {
+      out[c] = source < 0 ? T(0) : T(src[source * channels + c]);
+    }
+  };
+
+  for (int x = -radius; x < 0; ++x) {
+    fill_pixel(x);
+  }
+  for (int x = width; x < width + radius; ++x) {
+    fill_pixel(x);
+  }
+}
+
+// Whole image with `radius` border pixels on every side, for filters whose
+// inner loops read a 2D neighbourhood
+inline Image pad_image(ConstImageView image, int radius, BorderMode mode,
+                       bool parallel) {
+  const BorderTable columns = make_border_table(image.width(), radius, mode);
+  const BorderTable rows = make_border_table(image.height(), radius, mode);
+
+  Image padded;
+  padded.allocate(image.width() + 2 * radius, image.height() + 2 * radius,
+                  image.channels());
+  std::fill(padded.m_data.begin(), padded.m_data.end(), uint8_t{0});
+
+#  pragma omp parallel for if (parallel)
+  for (int y = -radius; y < image.height() + radius; ++y) {
+    const int source = rows(y);
+    if (source < 0) {
+      continue;  // constant border, already zero
+    }
+
+    pad_row(image.row(source), image.channels(), columns,
+            padded.row(y + radius));
+  }
+
+  return padded;
+}
+}  // namespace imgr
+
+#endif  // !IMGR_FILTER_BORDER_H
@@ -0,0 +1,126 @@
+#pragma once
+
+#ifndef IMGR_FILTER_CONVOLUTION_H
+#  define IMGR_FILTER_CONVOLUTION_H
+
+#  include <omp.h>
+
+#  include <algorithm>
+#  include <iostream>
+#  include <vector>
+
+#  include "../Image.h"
+#  include "Border.h"
+#  include "FFTConvolution.h"
+#  include "../simd/convolve.h"
+
+namespace imgr {
+// Arbitrary, non-separable 2D kernels. Small kernels run the direct stencil,
+// large ones go through FFTConvolution once its estimated cost is lower.
+// The two round differently: the stencil truncates its sums to bytes, the
+// FFT rounds to nearest, so outputs shift by up to 1 where the choice flips
+// with the kernel or image size.
+class Convolution {
+ public:
+  // Correlates img with a kernel_width x kernel_height kernel, row-major and
+  // centred on (kernel_width / 2, kernel_height / 2). The kernel is applied
+  // as given, so it should already sum to 1 for a blur.
+  static void apply_kernel(ImageView img, const std::vector<float>& kernel,
+                           int kernel_width, int kernel_height,
+                           BorderMode border = BorderMode::clamp) {
+    run(img, kernel, kernel_width, kernel_height, border, false);
+  }
+
+  static void apply_kernel_parallel(ImageView img,
+                                    const std::vector<float>& kernel,
+                                    int kernel_width, int kernel_height,
+                                    BorderMode border = BorderMode::clamp) {
+    run(img, kernel, kernel_width, kernel_height, border, true);
+  }
+
+  static bool prefers_fft(ConstImageView img, int kernel_width,
+                          int kernel_height) {
+    return FFTConvolution::relative_cost(kernel_width, kernel_height,
+                                         img.width(), img.height()) < 1.0f;
+  }
+
+  // The stencil runs plane by plane on planar images, but the FFT transforms
+  // two interleaved channels at once
+  static PixelLayout preferred_layout() { return PixelLayout::interleaved; }
+
+ private:
+  static void run(ImageView img, const std::vector<float>& kernel,
+                  int kernel_width, int kernel_height, BorderMode border,
+                  bool parallel) {
+    if (kernel.size() !=
+        static_cast<size_t>(kernel_width) * kernel_height) {
+      std::cerr << "Kernel has " << kernel.size() << " weights, expected "
+                << kernel_width << "x" << kernel_height << std::endl;
+      return;
+    }
+
+    if (prefers_fft(img, kernel_width, kernel_height)) {
+#  ifdef DEBUG_PRINT
+      std::cout << "Convolution: FFT for " << kernel_width << "x"
+                << kernel_height << " kernel" << std::endl;
+#  endif
+      FFTConvolution::apply(img, kernel, kernel_width, kernel_height, border,
+                            parallel);
+    } else {
+      for_each_plane(img, [&](ImageView plane) {
+        direct(plane, kernel, kernel_width, kernel_height, border, parallel);
+      });
+    }
+  }
+
+  // Full 2D stencil: for every output row, each kernel row is applied to the
+  // matching padded source row with the vectorized row kernel
+  static void direct(ImageView img, const std::vector<float>& kernel,
+                     int kernel_width, int kernel_height, BorderMode border,
+                     bool parallel) {
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int stride = width * channels;
+    const int radius_x = kernel_width / 2;
+    const int radius_y = kernel_height / 2;
+    const BorderTable columns = make_border_table(width, radius_x, border);
+    const BorderTable rows = make_border_table(height, radius_y, border);
+
+    // Rows read their neighbours, so results go to a second buffer
+    OutOfPlace pass(img);
+    const ConstImageView& source = pass.source();
+    const ImageView& target = pass.target();
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<float> padded((width + 2 * radius_x) * channels);
+      std::vector<float> acc(stride);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        for (int ky = 0; ky < kernel_height; ++ky) {
+          const int ny = rows(y + ky - radius_y);
+          if (ny < 0) {
+            std::fill(padded.begin(), padded.end(), 0.0f);
+          } else {
+            pad_row(source.row(ny), channels, columns, padded.data());
+          }
+          simd::convolve_row(padded.data(), acc.data(), stride,
+                             kernel.data() + ky * kernel_width, kernel_width,
+                             channels, ky != 0);
+        }
+
+        uint8_t* dst = target.row(y);
+        for (int i = 0; i < stride; ++i) {
+          dst[i] =
+              static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, acc[i])));
+        }
+      }
+    }
+    pass.finish();
+  }
+};
+}  // namespace imgr
+
+#endif  // !IMGR_FILTER_CONVOLUTION_H
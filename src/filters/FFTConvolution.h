@@ -0,0 +1,350 @@
+#pragma once
+
+#ifndef IMGR_FILTER_FFT_CONVOLUTION_H
+#  define IMGR_FILTER_FFT_CONVOLUTION_H
+
+#  include <omp.h>
+
+#  include <algorithm>
+#  include <cmath>
+#  include <complex>
+#  include <vector>
+
+#  include "../Image.h"
+#  include "Border.h"
+#  include "../simd/cpu_features.h"
+
+namespace imgr {
+// 2D correlation through the frequency domain, for kernels too large for the
+// direct stencil. The image is cut into blocks that are convolved with a
+// power-of-two FFT and the wrapped-around part of each block is discarded
+// (overlap-save), so blocks write disjoint outputs and run in any order.
+// Two channels share one complex transform, one in the real part and one in
+// the imaginary part: the kernel is real, so they never mix.
+class FFTConvolution {
+ public:
+  using Complex = std::complex<float>;
+
+  // Correlates img with a kernel_width x kernel_height kernel, row-major,
+  // centred on (kernel_width / 2, kernel_height / 2). Same result as the
+  // direct stencil up to float rounding, except that outputs are rounded
+  // instead of truncated.
+  static void apply(ImageView img, const std::vector<float>& kernel,
+                    int kernel_width, int kernel_height, BorderMode border,
+                    bool parallel) {
+    // Planes would each fill only half of a transform
+    if (img.planar()) {
+      with_interleaved(img, parallel, [&](ImageView pixels) {
+        apply(pixels, kernel, kernel_width, kernel_height, border, parallel);
+      });
+      return;
+    }
+
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int radius_x = kernel_width / 2;
+    const int radius_y = kernel_height / 2;
+    const int radius = std::max(radius_x, radius_y);
+
+    const int size_x = block_size(kernel_width, width);
+    const int size_y = block_size(kernel_height, height);
+    const int valid_x = size_x - kernel_width + 1;
+    const int valid_y = size_y - kernel_height + 1;
+    const int blocks_x = (width + valid_x - 1) / valid_x;
+    const int blocks_y = (height + valid_y - 1) / valid_y;
+    const int pairs = (channels + 1) / 2;
+    const int num_items = blocks_x * blocks_y * pairs;
+
+    const Plan plan_x = make_plan(size_x);
+    const Plan plan_y = make_plan(size_y);
+    const std::vector<Complex> spectrum = kernel_spectrum(
+        kernel, kernel_width, kernel_height, plan_x, plan_y);
+
+    // Also serves as the copy the blocks read from
+    const Image padded = pad_image(img, radius, border, parallel);
+    const int padded_stride = padded.m_width * channels;
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<Complex> block(static_cast<size_t>(size_x) * size_y);
+      std::vector<Complex> transposed(block.size());
+
+#  pragma omp for schedule(dynamic)
+      for (int item = 0; item < num_items; ++item) {
+        const int pair = item % pairs;
+        const int block_index = item / pairs;
+        const int x0 = (block_index % blocks_x) * valid_x;
+        const int y0 = (block_index / blocks_x) * valid_y;
+        const int first = 2 * pair;
+        const bool has_second = first + 1 < channels;
+
+        // Top-left of the block in padded coordinates
+        const int px = x0 - radius_x + radius;
+        const int py = y0 - radius_y + radius;
+        const int rows = std::min(size_y, padded.m_height - py);
+        const int cols = std::min(size_x, padded.m_width - px);
+
+        for (int u = 0; u < size_y; ++u) {
+          Complex* row = block.data() + static_cast<size_t>(u) * size_x;
+          if (u >= rows) {
+            std::fill(row, row + size_x, Complex());
+            continue;
+          }
+
+          const uint8_t* src = padded.m_data.data() +
+                               static_cast<size_t>(py + u) * padded_stride +
+                               px * channels + first;
+          for (int v = 0; v < cols; ++v) {
+            row[v] = Complex(src[v * channels],
+                             has_second ? src[v * channels + 1] : 0);
+          }
+          std::fill(row + cols, row + size_x, Complex());
+          transform(row, plan_x, false);
+        }
+
+        // Columns are transformed as rows of the transpose
+        transpose(block.data(), size_x, transposed.data(), size_y, size_y,
+                  size_x);
+        for (int v = 0; v < size_x; ++v) {
+          Complex* row = transposed.data() + static_cast<size_t>(v) * size_y;
+          transform(row, plan_y, false);
+
+          const Complex* weights =
+              spectrum.data() + static_cast<size_t>(v) * size_y;
+          for (int u = 0; u < size_y; ++u) {
+            row[u] = multiply(row[u], weights[u]);
+          }
+          transform(row, plan_y, true);
+        }
+
+        // Only the first valid_y rows hold outputs
+        const int out_rows = std::min(valid_y, height - y0);
+        const int out_cols = std::min(valid_x, width - x0);
+        transpose(transposed.data(), size_y, block.data(), size_x, size_x,
+                  out_rows);
+
+        for (int u = 0; u < out_rows; ++u) {
+          Complex* row = block.data() + static_cast<size_t>(u) * size_x;
+          transform(row, plan_x, true);
+
+          uint8_t* dst = img.row(y0 + u) + x0 * channels + first;
+          for (int v = 0; v < out_cols; ++v) {
+            dst[v * channels] = to_byte(row[v].real());
+            if (has_second) {
+              dst[v * channels + 1] = to_byte(row[v].imag());
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Estimated cost of the FFT path relative to the direct stencil for one
+  // output sample; the FFT wins below 1. The direct stencil runs on the
+  // vectorized row kernels, so its cost per tap depends on the ISA tier.
+  static float relative_cost(int kernel_width, int kernel_height,
+                             int image_width, int image_height) {
+    const int size_x = block_size(kernel_width, image_width);
+    const int size_y = block_size(kernel_height, image_height);
+    const double valid = static_cast<double>(size_x - kernel_width + 1) *
+                         (size_y - kernel_height + 1);
+
+    // Forward and inverse 2D transforms, each shared by two channels
+    const double butterflies = static_cast<double>(size_x) * size_y *
+                               std::log2(static_cast<double>(size_x) * size_y);
+    const double fft_cost = kButterflyCost * butterflies / valid;
+    const double direct_cost = direct_tap_cost() * kernel_width * kernel_height;
+
+    return static_cast<float>(fft_cost / direct_cost);
+  }
+
+ private:
+  // In units of one scalar direct tap, measured on 8-bit RGB images
+  static constexpr double kButterflyCost = 2.5;
+  static constexpr int kMaxBlock = 256;
+
+  static double direct_tap_cost() {
+    switch (simd::isa_level()) {
+    case simd::IsaLevel::sse41:  return 1.0 / 6;
+    case simd::IsaLevel::avx2:   return 1.0 / 10;
+    case simd::IsaLevel::avx512: return 1.0 / 13;
+    case simd::IsaLevel::scalar:
+    default:                     return 1.0;
+    }
+  }
+
+  // Bit-reversal permutation and the first half of the roots of unity, for
+  // both directions
+  struct Plan {
+    int size;
+    std::vector<int> bit_reverse;
+    std::vector<Complex> twiddles;
+    std::vector<Complex> inverse_twiddles;
+  };
+
+  // Power of two with the fewest butterflies per valid output, and no
+  // larger than one block over the whole image. Blocks stay within
+  // kMaxBlock, so a block and its transpose fit in L2, unless the kernel
+  // needs more: the search then goes up to the first power of two of at
+  // least twice the kernel, which leaves half the block valid.
+  static int block_size(int kernel, int image) {
+    int whole = 1;
+    while (whole < image + kernel - 1) {
+      whole *= 2;
+    }
+
+    int limit = kMaxBlock;
+    while (limit < 2 * kernel) {
+      limit *= 2;
+    }
+
+    int best = 0;
+    double best_cost = 0.0;
+    for (int size = 16; size <= limit; size *= 2) {
+      if (size < kernel) {
+        continue;
+      }
+      if (size >= whole) {
+        return best == 0 ? whole : best;
+      }
+      const double valid = size - kernel + 1;
+      const double cost = size * std::log2(static_cast<double>(size)) /
+                          (valid * valid) * size;
+      if (best == 0 || cost < best_cost) {
+        best = size;
+        best_cost = cost;
+      }
+    }
+
+    return best;
+  }
+
+  static Plan make_plan(int size) {
+    Plan plan{size, std::vector<int>(size), std::vector<Complex>(size / 2),
+              std::vector<Complex>(size / 2)};
+
+    int bits = 0;
+    while ((1 << bits) < size) {
+      ++bits;
+    }
+    for (int i = 0; i < size; ++i) {
+      int reversed = 0;
+      for (int b = 0; b < bits; ++b) {
+        reversed |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      plan.bit_reverse[i] = reversed;
+    }
+
+    for (int k = 0; k < size / 2; ++k) {
+      const double angle = -2.0 * M_PI * k / size;
+      plan.twiddles[k] = Complex(static_cast<float>(std::cos(angle)),
+                                 static_cast<float>(std::sin(angle)));
+      plan.inverse_twiddles[k] = std::conj(plan.twiddles[k]);
+    }
+
+    return plan;
+  }
+
+  // Written out so it is not routed through the NaN-checking library call
+  static Complex multiply(Complex a, Complex b) {
+    return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+  }
+
+  // In-place iterative radix-2 transform. The inverse is not scaled; the
+  // 1 / (size_x * size_y) factor is folded into the kernel spectrum.
+  static void transform(Complex* data, const Plan& plan, bool inverse) {
+    const int size = plan.size;
+
+    for (int i = 0; i < size; ++i) {
+      const int j = plan.bit_reverse[i];
+      if (i < j) {
+        std::swap(data[i], data[j]);
+      }
+    }
+
+    const Complex* twiddles =
+        inverse ? plan.inverse_twiddles.data() : plan.twiddles.data();
+
+    // Blocks are usually at most kMaxBlock long, so striding over them with
+    // a fixed twiddle stays in L1; only kernels wider than 128 go past it
+    for (int length = 2; length <= size; length *= 2) {
+      const int half = length / 2;
+      const int step = size / length;
+
+      for (int k = 0; k < half; ++k) {
+        const Complex w = twiddles[k * step];
+        for (int start = k; start < size; start += length) {
+          const Complex a = data[start];
+          const Complex b = multiply(data[start + half], w);
+          data[start] = a + b;
+          data[start + half] = a - b;
+        }
+      }
+    }
+  }
+
+  // dst[c][r] = src[r][c] over a rows x cols region, in 16x16 blocks
+  static void transpose(const Complex* src, int src_stride, Complex* dst,
+                        int dst_stride, int rows, int cols) {
+    constexpr int kBlock = 16;
+
+    for (int r0 = 0; r0 < rows; r0 += kBlock) {
+      for (int c0 = 0; c0 < cols; c0 += kBlock) {
+        const int r1 = std::min(r0 + kBlock, rows);
+        const int c1 = std::min(c0 + kBlock, cols);
+        for (int r = r0; r < r1; ++r) {
+          for (int c = c0; c < c1; ++c) {
+            dst[static_cast<size_t>(c) * dst_stride + r] =
+                src[static_cast<size_t>(r) * src_stride + c];
+          }
+        }
+      }
+    }
+  }
+
+  // Transform of the flipped kernel, in the transposed layout the blocks
+  // end up in, scaled by the inverse transform's normalisation
+  static std::vector<Complex> kernel_spectrum(const std::vector<float>& kernel,
+                                              int kernel_width,
+                                              int kernel_height,
+                                              const Plan& plan_x,
+                                              const Plan& plan_y) {
+    const int size_x = plan_x.size;
+    const int size_y = plan_y.size;
+    const float scale = 1.0f / (static_cast<float>(size_x) * size_y);
+
+    // Correlation is convolution with the kernel mirrored around the origin
+    std::vector<Complex> flipped(static_cast<size_t>(size_x) * size_y);
+    for (int j = 0; j < kernel_height; ++j) {
+      for (int i = 0; i < kernel_width; ++i) {
+        const int u = (size_y - j) % size_y;
+        const int v = (size_x - i) % size_x;
+        flipped[static_cast<size_t>(u) * size_x + v] =
+            Complex(kernel[j * kernel_width + i] * scale, 0.0f);
+      }
+    }
+
+    for (int u = 0; u < size_y; ++u) {
+      transform(flipped.data() + static_cast<size_t>(u) * size_x, plan_x,
+                false);
+    }
+
+    std::vector<Complex> spectrum(flipped.size());
+    transpose(flipped.data(), size_x, spectrum.data(), size_y, size_y, size_x);
+    for (int v = 0; v < size_x; ++v) {
+      transform(spectrum.data() + static_cast<size_t>(v) * size_y, plan_y,
+                false);
+    }
+
+    return spectrum;
+  }
+
+  static uint8_t to_byte(float value) {
+    return static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value + 0.5f)));
+  }
+};
+}  // namespace imgr
+
+#endif  // !IMGR_FILTER_FFT_CONVOLUTION_H
@@ -5,57 +5,173 @@
 
 #  include <omp.h>
 
+#  include <algorithm>
 #  include <cmath>
 #  include <iostream>
+#  include <utility>
 #  include <vector>
 
 #  include "../Image.h"
+#  include "Border.h"
+#  include "Convolution.h"
+#  include "KernelCache.h"
+#  include "../simd/convolve.h"
+#  include "../simd/convolve_fixed.h"
 
 namespace imgr {
+enum class GaussianEngine {
+  direct = 0,  // full 2D k*k kernel, FFT once that is cheaper
+  separable,   // two 1D passes, O(k) per pixel
+  recursive,   // Young - van Vliet IIR, O(1) per pixel, ignores kernel size
+  box,         // successive box passes, O(1) per pixel, ignores kernel size
+  fixed_point,  // separable with Q14 integer weights, within 1 of separable
+  tiled,        // separable in L2-sized 2D tiles, same output as separable
+  automatic,    // fastest of the above by a calibrated cost model
+};
+
+inline const char* gaussian_engine_name(GaussianEngine engine) {
+  switch (engine) {
+  case GaussianEngine::direct:      return "direct";
+  case GaussianEngine::recursive:   return "recursive";
+  case GaussianEngine::box:         return "box";
+  case GaussianEngine::fixed_point: return "fixed";
+  case GaussianEngine::tiled:       return "tiled";
+  case GaussianEngine::automatic:   return "auto";
+  case GaussianEngine::separable:
+  default:                          return "separable";
+  }
+}
+
+// How far the box approximation is from the exact 2D kernel
+struct BoxApproximationError {
+  float max_abs;  // largest per-weight difference
+  float rms;      // root mean square difference over the kernel support
+  float relative;  // max_abs relative to the kernel peak
+};
+
 class GaussianBlur {
  public:
+  // The 2D kernel is the outer product of the 1D one with itself, which is
+  // already normalized, so no exp is evaluated here
   static std::vector<float> generate_gaussian_kernel(int kernel_size,
                                                      float sigma) {
+    const auto row = KernelCache::gaussian(kernel_size, sigma);
     std::vector<float> kernel(kernel_size * kernel_size);
-    float sum = 0.0;
-    int radius = kernel_size / 2;
 
-    for (int y = -radius; y <= radius; ++y) {
-      for (int x = -radius; x <= radius; ++x) {
-        float exponent = -(x * x + y * y) / (2 * sigma * sigma);
-        float weight = std::exp(exponent);
-        int idx = (y + radius) * kernel_size + (x + radius);
-        kernel[idx] = weight;
-        sum += weight;
+    for (int y = 0; y < kernel_size; ++y) {
+      for (int x = 0; x < kernel_size; ++x) {
+        kernel[y * kernel_size + x] = row->weights[y] * row->weights[x];
       }
     }
 
-    // Normalize the kernel
-    for (float& w : kernel) {
-      w /= sum;
+    return kernel;
+  }
+
+  // 1D kernel for the separable passes. The 2D kernel above is the outer
+  // product of this one with itself, so running it once along rows and once
+  // along columns gives the same result with 2k taps instead of k*k.
+  // Engines read the cached kernel directly; this returns a copy.
+  static std::vector<float> generate_gaussian_kernel_1d(int kernel_size,
+                                                        float sigma) {
+    const auto kernel = KernelCache::gaussian(kernel_size, sigma);
+    return std::vector<float>(kernel->weights.begin(),
+                              kernel->weights.begin() + kernel_size);
+  }
+
+  // Box widths whose successive application approximates a Gaussian with the
+  // given sigma (W. M. Wells, "Efficient synthesis of Gaussian filters by
+  // cascaded uniform filters", 1986). Widths are odd and differ by 2 at most.
+  static std::vector<int> generate_box_sizes(float sigma, int passes = 3) {
+    const double ideal_width = std::sqrt(12.0 * sigma * sigma / passes + 1.0);
+    int lower_width = static_cast<int>(std::floor(ideal_width));
+    if (lower_width % 2 == 0) {
+      lower_width--;
     }
+    const int upper_width = lower_width + 2;
 
-    return kernel;
+    const double ideal_lower_count =
+        (12.0 * sigma * sigma - passes * lower_width * lower_width -
+         4.0 * passes * lower_width - 3.0 * passes) /
+        (-4.0 * lower_width - 4.0);
+    const int lower_count = static_cast<int>(std::round(ideal_lower_count));
+
+    std::vector<int> sizes(passes);
+    for (int i = 0; i < passes; ++i) {
+      sizes[i] = i < lower_count ? lower_width : upper_width;
+    }
+
+    return sizes;
   }
 
-  static std::pair<float, int> clalc_gaussian_params(const Image& image,
+  // Compares the kernel that the box passes add up to with
+  // generate_gaussian_kernel output of the same sigma and size
+  static BoxApproximationError box_approximation_error(float sigma,
+                                                       int kernel_size,
+                                                       int passes = 3) {
+    // Equivalent 1D kernel: the boxes convolved with each other
+    std::vector<double> box_kernel = {1.0};
+    for (int width : generate_box_sizes(sigma, passes)) {
+      std::vector<double> next(box_kernel.size() + width - 1, 0.0);
+      for (size_t i = 0; i < box_kernel.size(); ++i) {
+        for (int j = 0; j < width; ++j) {
+          next[i + j] += box_kernel[i] / width;
+        }
+      }
+      box_kernel = next;
+    }
+
+    const auto exact = generate_gaussian_kernel(kernel_size, sigma);
+    const int exact_radius = kernel_size / 2;
+    const int box_radius = static_cast<int>(box_kernel.size()) / 2;
+    const int radius = std::max(exact_radius, box_radius);
+
+    double max_abs = 0.0;
+    double squared_sum = 0.0;
+    double peak = 0.0;
+    for (int y = -radius; y <= radius; ++y) {
+      for (int x = -radius; x <= radius; ++x) {
+        double exact_weight = 0.0;
+        if (std::abs(x) <= exact_radius && std::abs(y) <= exact_radius) {
+          exact_weight = exact[(y + exact_radius) * kernel_size +
+                               (x + exact_radius)];
+        }
+
+        double box_weight = 0.0;
+        if (std::abs(x) <= box_radius && std::abs(y) <= box_radius) {
+          box_weight = box_kernel[y + box_radius] * box_kernel[x + box_radius];
+        }
+
+        const double diff = std::abs(exact_weight - box_weight);
+        max_abs = std::max(max_abs, diff);
+        squared_sum += diff * diff;
+        peak = std::max(peak, exact_weight);
+      }
+    }
+
+    const double count = (2.0 * radius + 1) * (2.0 * radius + 1);
+    return {static_cast<float>(max_abs),
+            static_cast<float>(std::sqrt(squared_sum / count)),
+            static_cast<float>(peak > 0.0 ? max_abs / peak : 0.0)};
+  }
+
+  static std::pair<float, int> clalc_gaussian_params(ConstImageView image,
                                                      int min_kernel_size = 3,
                                                      int max_kernel_size = 0) {
-    float sigma =
-        std::min(image.m_width, image.m_height) / (8.0 * image.m_channels);
+    const int width = image.width();
+    const int height = image.height();
+    float sigma = std::min(width, height) / (8.0 * image.channels());
 
     sigma = std::round(sigma * 100.0) / 100.0;
 
     int kernel_size = static_cast<int>(2 * std::ceil(3 * sigma) + 1);
 
     kernel_size = std::min(
-        kernel_size,
-        static_cast<int>(std::min(image.m_width, image.m_height) / 4.0));
+        kernel_size, static_cast<int>(std::min(width, height) / 4.0));
 
     if (max_kernel_size <= 0) {
       // Use 1/4 of image size or a reasonable maximum
       max_kernel_size = std::min(
-          static_cast<int>(std::min(image.m_width, image.m_height) / 4),
+          static_cast<int>(std::min(width, height) / 4),
           255  // Practical upper limit
       );
     }
@@ -74,60 +190,191 @@ class GaussianBlur {
     return {sigma, kernel_size};
   }
 
-  static void apply_gaussian_blur(Image& img, float sigma = 1.5f,
-                                  int kernel_size = 5) {
+  // Default blur: separable two-pass implementation
+  static void apply_gaussian_blur(
+      ImageView img, float sigma = 1.5f, int kernel_size = 5,
+      GaussianEngine engine = GaussianEngine::separable,
+      BorderMode border = BorderMode::clamp) {
     if (kernel_size % 2 == 0) {
       std::cout << "Kernel size must be odd number. Adjusting to "
                 << (kernel_size + 1) << std::endl;
       kernel_size += 1;
     }
 
-    // Generate kernel
-    auto kernel = generate_gaussian_kernel(kernel_size, sigma);
-
-    // Copy of image
-    Image original_img = img;
-    int radius = kernel_size / 2;
-
-    // Process each pixel
-    for (int y = 0; y < img.m_height; ++y) {
-      for (int x = 0; x < img.m_width; ++x) {
-        // Process each channel separately
-        for (int c = 0; c < img.m_channels; ++c) {
-          float pixel_value = 0.0f;
-          float kernel_sum = 0.0f;
-
-          // Apply kernel
-          for (int ky = -radius; ky <= radius; ++ky) {
-            for (int kx = -radius; kx <= radius; ++kx) {
-              int nx = std::max(0, std::min(x + kx, img.m_width - 1));
-              int ny = std::max(0, std::min(y + ky, img.m_height - 1));
-
-              // Get kernel weight
-              float weight =
-                  kernel[(ky + radius) * kernel_size + (kx + radius)];
-
-              // Get original pixel value
-              pixel_value +=
-                  original_img
-                      .m_data[(ny * img.m_width + nx) * img.m_channels + c] *
-                  weight;
-              kernel_sum += weight;
-            }
-          }
+    run_engine(img, sigma, kernel_size, engine, border, false);
+  }
 
-          // Normalize and update pixel
-          img.m_data[(y * img.m_width + x) * img.m_channels + c] =
-              static_cast<uint8_t>(
-                  std::min(255.0f, std::max(0.0f, pixel_value / kernel_sum)));
-        }
+  // Parallel Gaussian Blur with OpenMP
+  static void apply_gaussian_blur_parallel(
+      ImageView img, float sigma = 1.5f, int kernel_size = 5,
+      GaussianEngine engine = GaussianEngine::separable,
+      BorderMode border = BorderMode::clamp) {
+    // Validate kernel size (must be odd)
+    if (kernel_size % 2 == 0) {
+      std::cerr << "Kernel size must be an odd number. Adjusting to "
+                << (kernel_size + 1) << std::endl;
+      kernel_size += 1;
+    }
+
+    run_engine(img, sigma, kernel_size, engine, border, true);
+  }
+
+  // Separable blur of an interleaved float buffer in place, for filters that
+  // keep intermediate planes in float (e.g. structure tensors)
+  static void apply_gaussian_blur_float(float* data, int width, int height,
+                                        int channels, float sigma = 1.5f,
+                                        int kernel_size = 5,
+                                        BorderMode border = BorderMode::clamp) {
+    if (kernel_size % 2 == 0) {
+      std::cerr << "Kernel size must be an odd number. Adjusting to "
+                << (kernel_size + 1) << std::endl;
+      kernel_size += 1;
+    }
+
+    separable_blur(data, width, height, channels,
+                   static_cast<size_t>(width) * channels,
+                   *KernelCache::gaussian(kernel_size, sigma), border, false);
+  }
+
+  static void apply_gaussian_blur_float_parallel(
+      float* data, int width, int height, int channels, float sigma = 1.5f,
+      int kernel_size = 5, BorderMode border = BorderMode::clamp) {
+    if (kernel_size % 2 == 0) {
+      std::cerr << "Kernel size must be an odd number. Adjusting to "
+                << (kernel_size + 1) << std::endl;
+      kernel_size += 1;
+    }
+
+    separable_blur(data, width, height, channels,
+                   static_cast<size_t>(width) * channels,
+                   *KernelCache::gaussian(kernel_size, sigma), border, true);
+  }
+
+  // Sigma and kernel size from clalc_gaussian_params, run on whichever engine
+  // the cost model expects to be fastest for them
+  static void apply_gaussian_blur_adaptive(
+      ImageView img, BorderMode border = BorderMode::clamp) {
+    const auto [sigma, kernel_size] = clalc_gaussian_params(img);
+    run_engine(img, sigma, kernel_size, GaussianEngine::automatic, border,
+               false);
+  }
+
+  static void apply_gaussian_blur_adaptive_parallel(
+      ImageView img, BorderMode border = BorderMode::clamp) {
+    const auto [sigma, kernel_size] = clalc_gaussian_params(img);
+    run_engine(img, sigma, kernel_size, GaussianEngine::automatic, border,
+               true);
+  }
+
+  // Engine with the lowest predicted time for this job. Exact engines are
+  // always candidates; recursive and box approximate the untruncated
+  // Gaussian, so they are only considered once the kernel spans 6 sigma and
+  // truncation no longer shows. Calibrates on first use.
+  static GaussianEngine select_engine(ConstImageView img, float sigma,
+                                      int kernel_size, bool parallel) {
+    const int threads = parallel ? omp_get_max_threads() : 1;
+    const bool approximate_ok = kernel_size >= 6.0f * sigma;
+
+    GaussianEngine best = GaussianEngine::separable;
+    double best_time = predict_time(img, sigma, kernel_size, best, threads);
+
+    for (GaussianEngine engine :
+         {GaussianEngine::direct, GaussianEngine::fixed_point,
+          GaussianEngine::tiled, GaussianEngine::recursive,
+          GaussianEngine::box}) {
+      const bool approximate = engine == GaussianEngine::recursive ||
+                               engine == GaussianEngine::box;
+      if (approximate && !approximate_ok) {
+        continue;
+      }
+      const double time =
+          predict_time(img, sigma, kernel_size, engine, threads);
+      if (time < best_time) {
+        best = engine;
+        best_time = time;
       }
     }
+
+    return best;
   }
 
-  // Parallel Gaussian Blur with OpenMP
-  static void apply_gaussian_blur_parallel(Image& img, float sigma = 1.5f,
-                                           int kernel_size = 5) {
+  // Predicted run time in milliseconds
+  static double predict_time(ConstImageView img, float sigma, int kernel_size,
+                             GaussianEngine engine, int threads) {
+    if (engine == GaussianEngine::recursive && sigma < 0.5f) {
+      engine = GaussianEngine::box;  // what run_engine falls back to
+    }
+
+    const EngineCost& cost = cost_model()[static_cast<int>(engine)];
+    const double samples =
+        static_cast<double>(img.width()) * img.height() * img.channels();
+
+    double taps = kernel_size;
+    if (engine == GaussianEngine::direct) {
+      // The direct engine hands large kernels to the FFT
+      taps = static_cast<double>(kernel_size) * kernel_size *
+             std::min(1.0f, FFTConvolution::relative_cost(
+                                kernel_size, kernel_size, img.width(),
+                                img.height()));
+    } else if (engine == GaussianEngine::recursive ||
+               engine == GaussianEngine::box) {
+      taps = 0.0;
+    }
+
+    double per_sample = cost.base + cost.per_tap * taps;
+    if (samples * sizeof(float) > simd::l2_cache_size()) {
+      per_sample += cost.spill;
+    }
+
+    // Tiles are the unit of parallel work for the tiled engine, rows for the
+    // others
+    int units = img.height();
+    if (engine == GaussianEngine::tiled) {
+      const auto [tile_width, tile_height] = tile_size(img, kernel_size / 2);
+      units = ((img.width() + tile_width - 1) / tile_width) *
+              ((img.height() + tile_height - 1) / tile_height);
+    }
+
+    return samples * per_sample / std::max(1, std::min(threads, units)) *
+           1e-6;
+  }
+
+  // Fast approximation: 3 to 5 box passes per direction, each costing the same
+  // per pixel whatever sigma is
+  static void apply_gaussian_blur_box(ImageView img, float sigma = 1.5f,
+                                      int passes = 3,
+                                      BorderMode border = BorderMode::clamp) {
+    for_each_plane(img, [&](ImageView plane) {
+      box_blur(plane, sigma, passes, border, false);
+    });
+  }
+
+  static void apply_gaussian_blur_box_parallel(
+      ImageView img, float sigma = 1.5f, int passes = 3,
+      BorderMode border = BorderMode::clamp) {
+    for_each_plane(img, [&](ImageView plane) {
+      box_blur(plane, sigma, passes, border, true);
+    });
+  }
+
+  // Reference implementation with the full 2D k*k kernel
+  static void apply_gaussian_blur_2d(ImageView img, float sigma = 1.5f,
+                                     int kernel_size = 5,
+                                     BorderMode border = BorderMode::clamp) {
+    if (kernel_size % 2 == 0) {
+      std::cout << "Kernel size must be odd number. Adjusting to "
+                << (kernel_size + 1) << std::endl;
+      kernel_size += 1;
+    }
+
+    run_engine(img, sigma, kernel_size, GaussianEngine::direct, border,
+               false);
+  }
+
+  // Parallel 2D Gaussian Blur with OpenMP
+  static void apply_gaussian_blur_2d_parallel(
+      ImageView img, float sigma = 1.5f, int kernel_size = 5,
+      BorderMode border = BorderMode::clamp) {
     // Validate kernel size (must be odd)
     if (kernel_size % 2 == 0) {
       std::cerr << "Kernel size must be an odd number. Adjusting to "
@@ -135,48 +382,790 @@ class GaussianBlur {
       kernel_size += 1;
     }
 
-    // Generate Gaussian kernel
-    auto kernel = generate_gaussian_kernel(kernel_size, sigma);
-
-    // Create a copy of the original image to read from
-    Image original_img = img;
-    int radius = kernel_size / 2;
-
-    // Parallel processing of image
-#  pragma omp parallel for collapse(2)
-    for (int y = 0; y < img.m_height; ++y) {
-      for (int x = 0; x < img.m_width; ++x) {
-        // Process each channel separately
-        for (int c = 0; c < img.m_channels; ++c) {
-          float pixel_value = 0.0f;
-          float kernel_sum = 0.0f;
-
-          // Apply kernel
-          for (int ky = -radius; ky <= radius; ++ky) {
-            for (int kx = -radius; kx <= radius; ++kx) {
-              int nx = std::max(0, std::min(x + kx, img.m_width - 1));
-              int ny = std::max(0, std::min(y + ky, img.m_height - 1));
-
-              // Get kernel weight
-              float weight =
-                  kernel[(ky + radius) * kernel_size + (kx + radius)];
-
-              // Get original pixel value
-              pixel_value +=
-                  original_img
-                      .m_data[(ny * img.m_width + nx) * img.m_channels + c] *
-                  weight;
-              kernel_sum += weight;
+    run_engine(img, sigma, kernel_size, GaussianEngine::direct, border,
+               true);
+  }
+
+  // Engines blur every channel alike and take either layout, running plane
+  // by plane on planar images. The row kernels already treat interleaved
+  // rows as flat runs of lanes, so planes gain a few percent at most. Tiles
+  // of one plane each cover less of the image, and direct interleaves
+  // planes again for the FFT.
+  static PixelLayout preferred_layout(GaussianEngine engine) {
+    return engine == GaussianEngine::tiled ||
+                   engine == GaussianEngine::direct ||
+                   engine == GaussianEngine::automatic
+               ? PixelLayout::interleaved
+               : PixelLayout::planar;
+  }
+
+ private:
+  static void run_engine(ImageView img, float sigma, int kernel_size,
+                         GaussianEngine engine, BorderMode border,
+                         bool parallel) {
+    // Channels blur independently, so each plane runs as a 1-channel image.
+    // The automatic engine picks one engine for all of them first, and
+    // direct leaves planes to Convolution, whose FFT pairs channels.
+    if (img.planar() && engine != GaussianEngine::automatic &&
+        engine != GaussianEngine::direct) {
+      for_each_plane(img, [&](ImageView plane) {
+        run_engine(plane, sigma, kernel_size, engine, border, parallel);
+      });
+      return;
+    }
+
+    switch (engine) {
+    case GaussianEngine::direct:
+      direct_blur(img, generate_gaussian_kernel(kernel_size, sigma), border,
+                  parallel);
+      break;
+    case GaussianEngine::recursive:
+      // The recursive coefficients are only valid from sigma = 0.5 up
+      if (sigma >= 0.5f) {
+        recursive_blur(img, sigma, border, parallel);
+        break;
+      }
+      [[fallthrough]];
+    case GaussianEngine::box:
+      box_blur(img, sigma, 3, border, parallel);
+      break;
+    case GaussianEngine::fixed_point:
+      fixed_point_blur(
+          img, *KernelCache::gaussian(kernel_size, sigma, KernelPrecision::q14),
+          border, parallel);
+      break;
+    case GaussianEngine::tiled:
+      tiled_blur(img, *KernelCache::gaussian(kernel_size, sigma), border,
+                 parallel);
+      break;
+    case GaussianEngine::automatic: {
+      const GaussianEngine chosen =
+          select_engine(img, sigma, kernel_size, parallel);
+      std::cout << "Gaussian blur: automatic engine chose "
+                << gaussian_engine_name(chosen) << " for sigma " << sigma
+                << ", kernel " << kernel_size << " (predicted "
+                << predict_time(img, sigma, kernel_size, chosen,
+                                parallel ? omp_get_max_threads() : 1)
+                << " ms)" << std::endl;
+      run_engine(img, sigma, kernel_size, chosen, border, parallel);
+      break;
+    }
+    case GaussianEngine::separable:
+    default:
+      separable_blur(img, *KernelCache::gaussian(kernel_size, sigma), border,
+                     parallel);
+      break;
+    }
+  }
+
+  // Single-thread nanoseconds per sample: base + per_tap * taps, plus spill
+  // once the float intermediate no longer fits in L2. Taps is the kernel
+  // size for the separable engines, the stencil area (scaled down where the
+  // FFT takes over) for direct, and 0 for the constant-time engines.
+  struct EngineCost {
+    double base;
+    double per_tap;
+    double spill;
+  };
+
+  static constexpr int kNumEngines =
+      static_cast<int>(GaussianEngine::automatic);
+
+  // Measured once per process on synthetic images: two kernel sizes on an
+  // image that fits in L2 give base and per_tap, one run on an image that
+  // does not gives spill. Takes about 0.1 s in an optimized build.
+  static const std::vector<EngineCost>& cost_model() {
+    static const std::vector<EngineCost> model = calibrate();
+    return model;
+  }
+
+  static std::vector<EngineCost> calibrate() {
+    // The large image's float intermediate is twice the size of L2
+    const int large_height = std::max(
+        64, static_cast<int>(2 * simd::l2_cache_size() / sizeof(float) /
+                             (512 * 3)));
+    const Image small = calibration_image(128, 128);
+    const Image large = calibration_image(512, large_height);
+    const float sigma = 1.5f;
+
+    // Best of two on the small image, where noise matters most
+    auto measure = [&](const Image& source, GaussianEngine engine,
+                       int kernel_size) {
+      const int runs = &source == &small ? 2 : 1;
+      double best = 0.0;
+      for (int run = 0; run < runs; ++run) {
+        Image img = source;
+        const double start = omp_get_wtime();
+        if (engine == GaussianEngine::tiled) {
+          tiled_blur(img, *KernelCache::gaussian(kernel_size, sigma),
+                     BorderMode::clamp, false, false);
+        } else {
+          run_engine(img, sigma, kernel_size, engine, BorderMode::clamp,
+                     false);
+        }
+        const double ns = (omp_get_wtime() - start) * 1e9 /
+                          static_cast<double>(img.m_data.size());
+        best = run == 0 ? ns : std::min(best, ns);
+      }
+      return best;
+    };
+
+    std::vector<EngineCost> model(kNumEngines);
+    for (int e = 0; e < kNumEngines; ++e) {
+      const GaussianEngine engine = static_cast<GaussianEngine>(e);
+      EngineCost& cost = model[e];
+
+      // Direct stays below the FFT crossover here so it times the stencil
+      const bool constant = engine == GaussianEngine::recursive ||
+                            engine == GaussianEngine::box;
+      const int low = 3;
+      const int high = engine == GaussianEngine::direct ? 5 : 15;
+      const double low_taps = engine == GaussianEngine::direct ? 9.0 : low;
+      const double high_taps = engine == GaussianEngine::direct ? 25.0 : high;
+
+      const double t_low = measure(small, engine, low);
+      const double t_high = measure(small, engine, high);
+      if (constant) {
+        cost.base = std::min(t_low, t_high);
+        cost.per_tap = 0.0;
+      } else {
+        cost.per_tap =
+            std::max(0.0, (t_high - t_low) / (high_taps - low_taps));
+        cost.base = std::max(0.0, t_low - cost.per_tap * low_taps);
+      }
+
+      if (engine == GaussianEngine::direct) {
+        cost.spill = 0.0;  // reads bytes, and a large run costs too much
+      } else {
+        const double taps = constant ? 0.0 : 9.0;
+        cost.spill = std::max(
+            0.0, measure(large, engine, 9) - cost.base - cost.per_tap * taps);
+      }
+
+#  ifdef DEBUG_PRINT
+      std::cout << "Blur cost model: " << gaussian_engine_name(engine)
+                << " base " << cost.base << " ns, per tap " << cost.per_tap
+                << " ns, spill " << cost.spill << " ns" << std::endl;
+#  endif
+    }
+
+    return model;
+  }
+
+  // Deterministic texture, so no engine gets an easy all-zero input
+  static Image calibration_image(int width, int height) {
+    Image img;
+    img.allocate(width, height, 3);
+    for (size_t i = 0; i < img.m_data.size(); ++i) {
+      img.m_data[i] = static_cast<uint8_t>((i * 2654435761u) >> 24);
+    }
+    return img;
+  }
+
+  static void store_row(const float* src, uint8_t* dst, int n) {
+    for (int i = 0; i < n; ++i) {
+      dst[i] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, src[i])));
+    }
+  }
+
+  static void store_row(const float* src, float* dst, int n) {
+    std::copy(src, src + n, dst);
+  }
+
+  // Full 2D kernel, through the direct stencil or, for large kernels, the
+  // FFT
+  static void direct_blur(ImageView img, const std::vector<float>& kernel,
+                          BorderMode border, bool parallel) {
+    const int kernel_size =
+        static_cast<int>(std::lround(std::sqrt(kernel.size())));
+
+    if (parallel) {
+      Convolution::apply_kernel_parallel(img, kernel, kernel_size,
+                                         kernel_size, border);
+    } else {
+      Convolution::apply_kernel(img, kernel, kernel_size, kernel_size, border);
+    }
+  }
+
+  // Horizontal pass from the image into a float buffer, then vertical pass
+  // from that buffer back into the image. The horizontal pass reads padded
+  // rows and the vertical one a table of row pointers, so no tap ever checks
+  // the borders.
+  static void separable_blur(ImageView img, const CachedKernel& kernel,
+                             BorderMode border, bool parallel) {
+    separable_blur(img.data(), img.width(), img.height(), img.channels(),
+                   img.stride(), kernel, border, parallel);
+  }
+
+  // Same passes on any interleaved buffer, 8-bit or float, whose rows are
+  // row_stride elements apart
+  template <typename T>
+  static void separable_blur(T* data, int width, int height, int channels,
+                             size_t row_stride, const CachedKernel& kernel,
+                             BorderMode border, bool parallel) {
+    const int stride = width * channels;
+    const int kernel_size = kernel.size;
+    const int radius = kernel_size / 2;
+    const BorderTable columns = make_border_table(width, radius, border);
+    const BorderTable rows = make_border_table(height, radius, border);
+
+    std::vector<float> horizontal(static_cast<size_t>(stride) * height);
+    const std::vector<float> zero_row(stride, 0.0f);
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<float> padded((width + 2 * radius) * channels);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        pad_row(data + y * row_stride, channels, columns, padded.data());
+        simd::convolve_row(padded.data(),
+                           horizontal.data() + static_cast<size_t>(y) * stride,
+                           stride, kernel.weights.data(), kernel_size,
+                           channels);
+      }
+    }
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<float> acc(stride);
+      std::vector<const float*> row_pointers(kernel_size);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        for (int k = -radius; k <= radius; ++k) {
+          const int ny = rows(y + k);
+          row_pointers[k + radius] =
+              ny < 0 ? zero_row.data()
+                     : horizontal.data() + static_cast<size_t>(ny) * stride;
+        }
+
+        simd::convolve_columns(row_pointers.data(), acc.data(), stride,
+                               kernel.weights.data(), kernel_size);
+        store_row(acc.data(), data + y * row_stride, stride);
+      }
+    }
+  }
+
+  // Tile edge lengths in pixels: rows of at least 256 pixels keep the row
+  // kernels streaming, and the float scratch of one tile (tile plus vertical
+  // halo) takes half of L2, leaving the rest for the source rows.
+  static std::pair<int, int> tile_size(ConstImageView img, int radius) {
+    const int channels = img.channels();
+    const int tile_width = std::min(img.width(), 256);
+    const long budget = simd::l2_cache_size() / 2;
+    const long row_bytes =
+        static_cast<long>(tile_width) * channels * sizeof(float);
+
+    int tile_height = static_cast<int>(budget / row_bytes) - 2 * radius;
+    tile_height = std::max(32, std::min(tile_height, img.height()));
+
+    return {tile_width, tile_height};
+  }
+
+  // Separable blur done one 2D tile at a time. Each thread owns its scratch,
+  // reused across tiles, and writes whole tile rows, so threads neither share
+  // the intermediate buffer nor false-share output cache lines. Output is
+  // identical to separable_blur.
+  static void tiled_blur(ImageView img, const CachedKernel& kernel,
+                         BorderMode border, bool parallel,
+                         bool report = true) {
+    const double start = omp_get_wtime();
+
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int kernel_size = kernel.size;
+    const int radius = kernel_size / 2;
+    const BorderTable columns = make_border_table(width, radius, border);
+    const BorderTable rows = make_border_table(height, radius, border);
+
+    const auto [tile_width, tile_height] = tile_size(img, radius);
+    const int tiles_x = (width + tile_width - 1) / tile_width;
+    const int tiles_y = (height + tile_height - 1) / tile_height;
+    const int num_tiles = tiles_x * tiles_y;
+
+    // Tiles read their halo from neighbours, so results go to a second
+    // buffer
+    OutOfPlace pass(img);
+    const ConstImageView& source = pass.source();
+    const ImageView& target = pass.target();
+    int num_threads = 1;
+
+#  pragma omp parallel if (parallel)
+    {
+#  pragma omp single
+      num_threads = omp_get_num_threads();
+
+      // Scratch rows padded to whole cache lines for the vertical pass
+      const size_t scratch_stride =
+          simd::padded_stride<float>(tile_width * channels);
+      std::vector<float> padded((tile_width + 2 * radius) * channels);
+      simd::AlignedVector<float> horizontal(scratch_stride *
+                                            (tile_height + 2 * radius));
+      std::vector<float> acc(scratch_stride);
+      std::vector<const float*> row_pointers(kernel_size);
+      const std::vector<float> zero_row(scratch_stride, 0.0f);
+
+#  pragma omp for schedule(guided)
+      for (int tile = 0; tile < num_tiles; ++tile) {
+        const int x0 = (tile % tiles_x) * tile_width;
+        const int y0 = (tile / tiles_x) * tile_height;
+        const int tw = std::min(tile_width, width - x0);
+        const int th = std::min(tile_height, height - y0);
+        const int n = tw * channels;
+
+        // Source columns [x0 - radius, x0 + tw + radius): the part inside
+        // the image is one contiguous copy, the rest comes from the table
+        const int inner_begin = std::max(x0 - radius, 0);
+        const int inner_end = std::min(x0 + tw + radius, width);
+
+        // Horizontal pass over the tile rows and their vertical halo
+        for (int y = y0 - radius; y < y0 + th + radius; ++y) {
+          float* dst = horizontal.data() +
+                       static_cast<size_t>(y - y0 + radius) * scratch_stride;
+          const int source_row = rows(y);
+          if (source_row < 0) {
+            std::fill(dst, dst + n, 0.0f);
+            continue;
+          }
+
+          const uint8_t* src = source.row(source_row);
+          for (int i = inner_begin * channels; i < inner_end * channels; ++i) {
+            padded[i - (x0 - radius) * channels] = src[i];
+          }
+          for (int x = x0 - radius; x < x0 + tw + radius; ++x) {
+            if (x >= inner_begin && x < inner_end) {
+              x = inner_end - 1;
+              continue;
+            }
+            const int column = columns(x);
+            for (int c = 0; c < channels; ++c) {
+              padded[(x - x0 + radius) * channels + c] =
+                  column < 0 ? 0.0f : src[column * channels + c];
             }
           }
 
-          // Normalize and update pixel
-          img.m_data[(y * img.m_width + x) * img.m_channels + c] =
-              static_cast<uint8_t>(
-                  std::min(255.0f, std::max(0.0f, pixel_value / kernel_sum)));
+          simd::convolve_row(padded.data(), dst, n, kernel.weights.data(),
+                             kernel_size, channels);
+        }
+
+        // Vertical pass, halo rows are already in the scratch
+        for (int y = 0; y < th; ++y) {
+          for (int k = 0; k < kernel_size; ++k) {
+            row_pointers[k] =
+                horizontal.data() + static_cast<size_t>(y + k) * scratch_stride;
+          }
+          simd::convolve_columns(row_pointers.data(), acc.data(), n,
+                                 kernel.weights.data(), kernel_size);
+          store_row(acc.data(), target.row(y0 + y) + x0 * channels, n);
         }
       }
     }
+    pass.finish();
+
+    if (report) {
+      std::cout << "Tiled blur: " << tile_width << "x" << tile_height
+                << " tiles (" << num_tiles << "), " << num_threads
+                << " threads, " << (omp_get_wtime() - start) * 1000.0
+                << " ms\n";
+    }
+  }
+
+  // Same two passes as separable_blur on integers: 8-bit pixels, Q14 weights
+  // and a Q7 int16 intermediate. Results are rounded rather than truncated,
+  // so they stay within 1 of the float path.
+  static void fixed_point_blur(ImageView img, const CachedKernel& kernel,
+                               BorderMode border, bool parallel) {
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int stride = width * channels;
+    const int kernel_size = kernel.size;
+    const int radius = kernel_size / 2;
+    const int16_t* weights = kernel.fixed_weights.data();
+    const BorderTable columns = make_border_table(width, radius, border);
+    const BorderTable rows = make_border_table(height, radius, border);
+
+    std::vector<int16_t> horizontal(static_cast<size_t>(stride) * height);
+    const std::vector<int16_t> zero_row(stride, 0);
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<int16_t> padded((width + 2 * radius) * channels);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        pad_row(img.row(y), channels, columns, padded.data());
+        simd::convolve_row_fixed(
+            padded.data(), horizontal.data() + static_cast<size_t>(y) * stride,
+            stride, weights, kernel_size, channels);
+      }
+    }
+
+#  pragma omp parallel if (parallel)
+    {
+      std::vector<const int16_t*> row_pointers(kernel_size);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        for (int k = -radius; k <= radius; ++k) {
+          const int ny = rows(y + k);
+          row_pointers[k + radius] =
+              ny < 0 ? zero_row.data()
+                     : horizontal.data() + static_cast<size_t>(ny) * stride;
+        }
+
+        simd::convolve_columns_fixed(row_pointers.data(), img.row(y), stride,
+                                     weights, kernel_size);
+      }
+    }
+  }
+
+  // Third order recursive filter coefficients from Young & van Vliet,
+  // "Recursive implementation of the Gaussian filter" (1995), already divided
+  // by b0. The same filter runs causally and then anti-causally. M is the
+  // Triggs & Sdika (2006) matrix that gives the exact anti-causal start state
+  // for a signal clamped past its right edge.
+  struct RecursiveCoefficients {
+    float B;
+    float b1;
+    float b2;
+    float b3;
+    float M[9];
+  };
+
+  static RecursiveCoefficients recursive_coefficients(float sigma) {
+    const double q = sigma >= 2.5f
+                         ? 0.98711 * sigma - 0.96330
+                         : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+    const double q2 = q * q;
+    const double q3 = q2 * q;
+
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    const double a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    const double a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    const double a3 = (0.422205 * q3) / b0;
+    const double B = 1.0 - (a1 + a2 + a3);
+
+    // B is folded into the matrix because both passes here are scaled by it
+    const double scale = B / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) *
+                              (1.0 + a2 + (a1 - a3) * a3));
+    const double M[9] = {
+        -a3 * a1 + 1.0 - a3 * a3 - a2,
+        (a3 + a1) * (a2 + a3 * a1),
+        a3 * (a1 + a3 * a2),
+        a1 + a3 * a2,
+        -(a2 - 1.0) * (a2 + a3 * a1),
+        -(a3 * a1 + a3 * a3 + a2 - 1.0) * a3,
+        a3 * a1 + a2 + a1 * a1 - a2 * a2,
+        a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3,
+        a3 * (a1 + a3 * a2),
+    };
+
+    RecursiveCoefficients co{static_cast<float>(B), static_cast<float>(a1),
+                             static_cast<float>(a2), static_cast<float>(a3),
+                             {}};
+    for (int i = 0; i < 9; ++i) {
+      co.M[i] = static_cast<float>(M[i] * scale);
+    }
+    return co;
+  }
+
+  // Given the input value at the right edge (u) and the last three causal
+  // outputs (v0 is the last one), returns the anti-causal outputs at the
+  // edge and the two virtual samples after it.
+  static void recursive_right_boundary(const RecursiveCoefficients& co,
+                                       float u, float v0, float v1, float v2,
+                                       float out[3]) {
+    const float d0 = v0 - u;
+    const float d1 = v1 - u;
+    const float d2 = v2 - u;
+    for (int i = 0; i < 3; ++i) {
+      out[i] = co.M[i * 3] * d0 + co.M[i * 3 + 1] * d1 + co.M[i * 3 + 2] * d2 +
+               u;
+    }
+  }
+
+  // Cost per pixel does not depend on sigma. Rows are filtered in parallel,
+  // then columns in parallel strips that walk the image top to bottom, so the
+  // inner loop stays contiguous. The boundary handling is exact for clamped
+  // borders; other modes pad the image by 4 sigma and crop afterwards.
+  static void recursive_blur(ImageView img, float sigma, BorderMode border,
+                             bool parallel) {
+    if (border != BorderMode::clamp) {
+      with_padded_border(img, static_cast<int>(std::ceil(4 * sigma)), border,
+                         parallel, [&](Image& padded) {
+                           recursive_blur(padded, sigma, BorderMode::clamp,
+                                          parallel);
+                         });
+      return;
+    }
+
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int stride = width * channels;
+    const RecursiveCoefficients co = recursive_coefficients(sigma);
+
+    // The boundary matrix needs three causal samples
+    if (width < 3 || height < 3) {
+      separable_blur(img,
+                     *KernelCache::gaussian(
+                         static_cast<int>(2 * std::ceil(3 * sigma) + 1), sigma),
+                     border, parallel);
+      return;
+    }
+
+    std::vector<float> buffer(static_cast<size_t>(stride) * height);
+
+#  pragma omp parallel for if (parallel)
+    for (int y = 0; y < height; ++y) {
+      float* row = buffer.data() + static_cast<size_t>(y) * stride;
+      std::copy_n(img.row(y), stride, row);
+
+      for (int c = 0; c < channels; ++c) {
+        float* p = row + c;
+        const float u = p[(width - 1) * channels];
+
+        // Causal pass, left to right
+        float w1 = p[0];
+        float w2 = w1;
+        float w3 = w1;
+        for (int x = 0; x < width; ++x) {
+          const float w = co.B * p[x * channels] + co.b1 * w1 + co.b2 * w2 +
+                          co.b3 * w3;
+          p[x * channels] = w;
+          w3 = w2;
+          w2 = w1;
+          w1 = w;
+        }
+
+        // Anti-causal pass, right to left
+        float edge[3];
+        recursive_right_boundary(co, u, w1, w2, w3, edge);
+        p[(width - 1) * channels] = edge[0];
+        w1 = edge[0];
+        w2 = edge[1];
+        w3 = edge[2];
+        for (int x = width - 2; x >= 0; --x) {
+          const float w = co.B * p[x * channels] + co.b1 * w1 + co.b2 * w2 +
+                          co.b3 * w3;
+          p[x * channels] = w;
+          w3 = w2;
+          w2 = w1;
+          w1 = w;
+        }
+      }
+    }
+
+    constexpr int strip_width = 256;
+    const int num_strips = (stride + strip_width - 1) / strip_width;
+
+#  pragma omp parallel for if (parallel)
+    for (int strip = 0; strip < num_strips; ++strip) {
+      const int begin = strip * strip_width;
+      const int len = std::min(strip_width, stride - begin);
+
+      float history[3][strip_width];
+      float edge_values[strip_width];
+      float* w1 = history[0];
+      float* w2 = history[1];
+      float* w3 = history[2];
+
+      float* const first = buffer.data() + begin;
+      float* const last =
+          buffer.data() + static_cast<size_t>(height - 1) * stride + begin;
+      std::copy(last, last + len, edge_values);
+
+      // Causal pass, top to bottom
+      for (int i = 0; i < len; ++i) {
+        w1[i] = w2[i] = w3[i] = first[i];
+      }
+      for (int y = 0; y < height; ++y) {
+        float* p = buffer.data() + static_cast<size_t>(y) * stride + begin;
+        for (int i = 0; i < len; ++i) {
+          p[i] = co.B * p[i] + co.b1 * w1[i] + co.b2 * w2[i] + co.b3 * w3[i];
+        }
+        // Rotate history: the oldest row is overwritten by the newest one
+        std::swap(w3, w2);
+        std::swap(w2, w1);
+        std::copy(p, p + len, w1);
+      }
+
+      // Anti-causal pass, bottom to top
+      for (int i = 0; i < len; ++i) {
+        float edge[3];
+        recursive_right_boundary(co, edge_values[i], w1[i], w2[i], w3[i],
+                                 edge);
+        last[i] = edge[0];
+        w1[i] = edge[0];
+        w2[i] = edge[1];
+        w3[i] = edge[2];
+      }
+      for (int y = height - 2; y >= 0; --y) {
+        float* p = buffer.data() + static_cast<size_t>(y) * stride + begin;
+        for (int i = 0; i < len; ++i) {
+          p[i] = co.B * p[i] + co.b1 * w1[i] + co.b2 * w2[i] + co.b3 * w3[i];
+        }
+        std::swap(w3, w2);
+        std::swap(w2, w1);
+        std::copy(p, p + len, w1);
+      }
+    }
+
+    round_rows(buffer, img, parallel);
+  }
+
+  // Runs `blur` on a copy of the image padded by `margin` pixels in the
+  // requested border mode and copies the interior back. For engines whose
+  // own edge handling does not match that mode.
+  template <typename Blur>
+  static void with_padded_border(ImageView img, int margin, BorderMode border,
+                                 bool parallel, Blur blur) {
+    Image padded = pad_image(img, margin, border, parallel);
+    blur(padded);
+
+    const ConstImageView interior =
+        padded.view(margin, margin, img.width(), img.height());
+#  pragma omp parallel for if (parallel)
+    for (int y = 0; y < img.height(); ++y) {
+      std::copy_n(interior.row(y), img.row_bytes(), img.row(y));
+    }
+  }
+
+  // Rounds a packed float copy of the image back into its rows
+  static void round_rows(const std::vector<float>& buffer, ImageView img,
+                         bool parallel) {
+    const int stride = img.width() * img.channels();
+#  pragma omp parallel for if (parallel)
+    for (int y = 0; y < img.height(); ++y) {
+      const float* src = buffer.data() + static_cast<size_t>(y) * stride;
+      uint8_t* dst = img.row(y);
+      for (int i = 0; i < stride; ++i) {
+        dst[i] = static_cast<uint8_t>(
+            std::min(255.0f, std::max(0.0f, src[i] + 0.5f)));
+      }
+    }
+  }
+
+  // Every pass keeps a running sum, adding the sample entering the box and
+  // dropping the one leaving it. Passes are applied along rows first, then
+  // along columns; both orders give the same result.
+  static void box_blur(ImageView img, float sigma, int passes,
+                       BorderMode border, bool parallel) {
+    if (passes < 3 || passes > 5) {
+      std::cerr << "Box approximation needs 3 to 5 passes, got " << passes
+                << ". Using 3\n";
+      passes = 3;
+    }
+
+    // Mirror and wrap borders commute with symmetric boxes, so applying them
+    // before every pass is exact. Clamp and constant borders are not: the
+    // first pass spreads the image into the border. Padding once by the
+    // reach of all passes together keeps their edges right.
+    if (border == BorderMode::clamp || border == BorderMode::constant) {
+      int reach = 0;
+      for (int box_size : generate_box_sizes(sigma, passes)) {
+        reach += box_size / 2;
+      }
+      if (reach > 0) {
+        with_padded_border(img, reach, border, parallel, [&](Image& padded) {
+          box_blur(padded, sigma, passes, BorderMode::mirror, parallel);
+        });
+        return;
+      }
+    }
+
+    const int width = img.width();
+    const int height = img.height();
+    const int channels = img.channels();
+    const int stride = width * channels;
+    const std::vector<int> box_sizes = generate_box_sizes(sigma, passes);
+    const int max_radius = box_sizes.back() / 2;
+    // One extra row: the running sum looks at radius + 1 ahead
+    const BorderTable rows = make_border_table(height, max_radius + 1, border);
+
+    std::vector<float> buffer(static_cast<size_t>(stride) * height);
+    std::vector<float> scratch(buffer.size());
+    const std::vector<float> zero_row(stride, 0.0f);
+
+#  pragma omp parallel if (parallel)
+    {
+      // Row with the border pixels of the current box on both sides, plus one
+      // pixel for the last (unused) running sum update
+      std::vector<float> padded((width + 2 * max_radius + 1) * channels);
+
+#  pragma omp for
+      for (int y = 0; y < height; ++y) {
+        float* row = buffer.data() + static_cast<size_t>(y) * stride;
+        std::copy_n(img.row(y), stride, row);
+
+        for (int box_size : box_sizes) {
+          const int radius = box_size / 2;
+          const float scale = 1.0f / box_size;
+
+          // Tables are cheap next to a full row pass, and boxes differ
+          const BorderTable columns = make_border_table(width, radius, border);
+          pad_row(row, channels, columns, padded.data());
+
+          for (int c = 0; c < channels; ++c) {
+            float sum = 0.0f;
+            for (int k = 0; k < box_size; ++k) {
+              sum += padded[k * channels + c];
+            }
+
+            for (int x = 0; x < width; ++x) {
+              row[x * channels + c] = sum * scale;
+              sum += padded[(x + box_size) * channels + c] -
+                     padded[x * channels + c];
+            }
+          }
+        }
+      }
+    }
+
+    constexpr int strip_width = 256;
+    const int num_strips = (stride + strip_width - 1) / strip_width;
+
+    for (int box_size : box_sizes) {
+      const int radius = box_size / 2;
+      const float scale = 1.0f / box_size;
+
+#  pragma omp parallel for if (parallel)
+      for (int strip = 0; strip < num_strips; ++strip) {
+        const int begin = strip * strip_width;
+        const int len = std::min(strip_width, stride - begin);
+        auto row_at = [&](int y) {
+          const int ny = rows(y);
+          return ny < 0 ? zero_row.data() + begin
+                        : buffer.data() + static_cast<size_t>(ny) * stride +
+                              begin;
+        };
+
+        float sum[strip_width] = {};
+        for (int k = -radius; k <= radius; ++k) {
+          const float* src = row_at(k);
+          for (int i = 0; i < len; ++i) {
+            sum[i] += src[i];
+          }
+        }
+
+        for (int y = 0; y < height; ++y) {
+          float* dst = scratch.data() + static_cast<size_t>(y) * stride + begin;
+          const float* entering = row_at(y + radius + 1);
+          const float* leaving = row_at(y - radius);
+          for (int i = 0; i < len; ++i) {
+            dst[i] = sum[i] * scale;
+            sum[i] += entering[i] - leaving[i];
+          }
+        }
+      }
+
+      buffer.swap(scratch);
+    }
+
+    round_rows(buffer, img, parallel);
   }
 };
 }  // namespace imgr
@@ -5,47 +5,164 @@
 
 #  include <omp.h>
 
-#  include <cmath>
+#  include <algorithm>
+#  include <cstdint>
 #  include <iostream>
-#  include <vector>
 
 #  include "../Image.h"
+#  include "../simd/grayscale.h"
 
 namespace imgr {
+enum class GrayscaleMode {
+  bt601 = 0,  // 0.299 R + 0.587 G + 0.114 B, SDTV / JPEG luma
+  bt709,      // 0.2126 R + 0.7152 G + 0.0722 B, HDTV / sRGB luma
+  average,    // (R + G + B) / 3
+  max,        // brightest of R, G and B
+};
+
+enum class GrayscaleOutput {
+  rgb = 0,  // gray in R, G and B, the image keeps its channels
+  gray,     // 1 channel, or gray + alpha: a third (or half) of the memory
+};
+
 class GrayScale {
  public:
-  static void grayscaleImage(imgr::Image& img) {
-    for (int y = 0; y < img.m_height; ++y) {
-      for (int x = 0; x < img.m_width; ++x) {
-        // Process each channel separately
-        unsigned char gray = 0;
-        for (int c = 0; c < img.m_channels; ++c) {
-          gray = gray > img.m_data[(y * img.m_width + x) * img.m_channels]
-                     ? gray
-                     : img.m_data[(y * img.m_width + x) * img.m_channels];
-        }
-        for (int c = 0; c < 3; ++c) {
-          img.m_data[(y * img.m_width + x) * img.m_channels + c] = gray;
-        }
-      }
+  // Gray is written into R, G and B, or with GrayscaleOutput::gray the image
+  // becomes 1-channel (2 with alpha), which `Image::write` encodes as a
+  // grayscale PNG or JPEG; that needs a whole image, a region keeps its
+  // channels. Alpha is kept. 1- and 2-channel images are gray already and
+  // are left as they are.
+  static void grayscaleImage(ImageView img,
+                             GrayscaleMode mode = GrayscaleMode::bt601,
+                             GrayscaleOutput output = GrayscaleOutput::rgb) {
+    run(img, mode, output, false);
+  }
+
+  // Blocks of pixels are split across threads, each one contiguous run for
+  // the SIMD kernel
+  static void grayscaleImageParallel(
+      ImageView img, GrayscaleMode mode = GrayscaleMode::bt601,
+      GrayscaleOutput output = GrayscaleOutput::rgb) {
+    run(img, mode, output, true);
+  }
+
+  // On planes gray is a weighted sum of three byte rows, with none of the
+  // shuffles that gather channels out of interleaved pixels
+  static PixelLayout preferred_layout() { return PixelLayout::planar; }
+
+ private:
+  // Pixels per work item: enough for the kernel to stream, small enough
+  // that a typical image still gives every thread several blocks
+  static constexpr int kBlockPixels = 1 << 13;
+
+  static simd::GrayMix mix(GrayscaleMode mode) {
+    // Q15, each set summing to exactly 32768 so white stays 255
+    switch (mode) {
+    case GrayscaleMode::bt709:   return {6966, 23436, 2366, false};
+    case GrayscaleMode::average: return {10923, 10923, 10922, false};
+    case GrayscaleMode::max:     return {0, 0, 0, true};
+    case GrayscaleMode::bt601:
+    default:                     return {9798, 19235, 3735, false};
     }
   }
 
-  static void grayscaleImageParallel(imgr::Image& img) {
-#  pragma omp parallel for collapse(2)
-    for (int y = 0; y < img.m_height; ++y) {
-      for (int x = 0; x < img.m_width; ++x) {
-        // Process each channel separately
-        unsigned char gray = 0;
-        for (int c = 0; c < img.m_channels; ++c) {
-          gray = gray > img.m_data[(y * img.m_width + x) * img.m_channels]
-                     ? gray
-                     : img.m_data[(y * img.m_width + x) * img.m_channels];
-        }
-        for (int c = 0; c < 3; ++c) {
-          img.m_data[(y * img.m_width + x) * img.m_channels + c] = gray;
-        }
+  static void run(ImageView img, GrayscaleMode mode, GrayscaleOutput output,
+                  bool parallel) {
+    if (img.channels() < 3) {
+      return;
+    }
+
+    if (img.channels() > 4) {
+      std::cerr << "Grayscale needs an RGB or RGBA image, got "
+                << img.channels() << " channels.\n";
+      return;
+    }
+
+    // The channel count is the image's, so a region cannot change it
+    Image* image = img.image();
+    if (output == GrayscaleOutput::gray && image == nullptr) {
+      std::cerr << "Single-channel grayscale needs a whole image, not a "
+                   "region of one.\n";
+      return;
+    }
+
+    const simd::GrayMix weights = mix(mode);
+    if (img.planar()) {
+      run_planes(img, weights, output, parallel);
+      return;
+    }
+
+    const int width = img.width();
+    const int channels = img.channels();
+
+    if (output == GrayscaleOutput::rgb) {
+      for_each_run(img, kBlockPixels, parallel, [&](int y, int x, int n) {
+        uint8_t* pixels = img.row(y) + x * channels;
+        simd::grayscale_row(pixels, pixels, n, channels, channels, weights);
+      });
+      return;
+    }
+
+    // RGB -> gray, RGBA -> gray + alpha
+    const int gray_channels = channels - 2;
+    PixelBuffer& gray = image->back_buffer(
+        image->buffer_size(gray_channels, PixelLayout::interleaved));
+    const ImageView target(
+        gray.data(), width, img.height(), gray_channels,
+        image->stride(gray_channels, PixelLayout::interleaved));
+
+    // Runs go past the end of a row only when both sides are packed
+    for_each_run(target.contiguous() ? img : target, kBlockPixels, parallel,
+                 [&](int y, int x, int n) {
+                   simd::grayscale_row(img.row(y) + x * channels,
+                                       target.row(y) + x * gray_channels, n,
+                                       channels, gray_channels, weights);
+                 });
+
+    image->swap_buffers();
+    image->m_channels = gray_channels;
+  }
+
+  // Planes need no shuffles: gray comes straight from the colour planes and
+  // is copied into each of them, or becomes the first plane of a compact
+  // image, followed by alpha's plane as it was
+  static void run_planes(ImageView img, const simd::GrayMix& weights,
+                         GrayscaleOutput output, bool parallel) {
+    const ImageView red = img.plane(0);
+    const ImageView green = img.plane(1);
+    const ImageView blue = img.plane(2);
+
+    if (output == GrayscaleOutput::rgb) {
+      for_each_run(red, kBlockPixels, parallel, [&](int y, int x, int n) {
+        uint8_t* gray = red.row(y) + x;
+        simd::grayscale_planes(gray, green.row(y) + x, blue.row(y) + x, gray,
+                               n, weights);
+        std::copy_n(gray, n, green.row(y) + x);
+        std::copy_n(gray, n, blue.row(y) + x);
+      });
+      return;
+    }
+
+    Image* image = img.image();
+    const int gray_channels = img.channels() - 2;
+    const size_t stride = image->stride(1, PixelLayout::planar);
+    const size_t plane = stride * img.height();
+    PixelBuffer& gray = image->back_buffer(plane * gray_channels);
+
+    for_each_run(red, kBlockPixels, parallel, [&](int y, int x, int n) {
+      const size_t first = static_cast<size_t>(y) * stride + x;
+      simd::grayscale_planes(red.row(y) + x, green.row(y) + x,
+                             blue.row(y) + x, gray.data() + first, n,
+                             weights);
+      if (gray_channels == 2) {
+        std::copy_n(img.plane(3).row(y) + x, n, gray.data() + plane + first);
       }
+    });
+
+    image->swap_buffers();
+    image->m_channels = gray_channels;
+    if (gray_channels == 1) {
+      image->m_layout = PixelLayout::interleaved;
     }
   }
 };
@@ -0,0 +1,207 @@
+#pragma once
+
+#ifndef IMGR_FILTER_KERNEL_CACHE_H
+#  define IMGR_FILTER_KERNEL_CACHE_H
+
+#  include <algorithm>
+#  include <array>
+#  include <cstdint>
+#  include <iostream>
+#  include <map>
+#  include <memory>
+#  include <mutex>
+#  include <tuple>
+#  include <utility>
+#  include <vector>
+
+#  include "../simd/aligned_allocator.h"
+#  include "../simd/convolve_fixed.h"
+
+namespace imgr {
+enum class KernelPrecision {
+  f32 = 0,  // float weights summing to 1
+  q14,      // int16 weights summing to exactly 1 << 14
+};
+
+// Normalized 1D Gaussian, shared between callers. Weights start on a 64-byte
+// boundary and are zero-padded to a whole number of 64-byte lines, so SIMD
+// code may load past `size` without reading garbage.
+struct CachedKernel {
+  int size;
+  float sigma;
+  KernelPrecision precision;
+  simd::AlignedVector<float> weights;          // f32 only
+  simd::AlignedVector<int16_t> fixed_weights;  // q14 only
+};
+
+namespace detail {
+// std::exp is not constexpr. Reduces x = k ln2 + r with |r| <= ln2 / 2, sums
+// the Taylor series of e^r and scales by 2^k; accurate to a few ulp in
+// double, which is far below float resolution.
+constexpr double constexpr_exp(double x) {
+  if (x < -708.0) {
+    return 0.0;
+  }
+
+  constexpr double kLn2 = 0.693147180559945309417;
+  const double q = x / kLn2;
+  const int k = static_cast<int>(q < 0 ? q - 0.5 : q + 0.5);
+  const double r = x - k * kLn2;
+
+  double term = 1.0;
+  double sum = 1.0;
+  for (int n = 1; n < 20; ++n) {
+    term *= r / n;
+    sum += term;
+  }
+
+  for (int i = 0; i < k; ++i) {
+    sum *= 2.0;
+  }
+  for (int i = 0; i > k; --i) {
+    sum *= 0.5;
+  }
+
+  return sum;
+}
+
+// The one definition of the weights, used for the compile-time tables and
+// for sizes computed at run time, so both give bit-identical kernels.
+// Computed and normalized in double, rounded to float once.
+template <typename Weights>
+constexpr void fill_gaussian(int size, float sigma, Weights& weights) {
+  const int radius = size / 2;
+  const double s = sigma;
+  double sum = 0.0;
+
+  for (int x = -radius; x <= radius; ++x) {
+    sum += constexpr_exp(-(x * x) / (2.0 * s * s));
+  }
+  for (int x = -radius; x <= radius; ++x) {
+    weights[x + radius] =
+        static_cast<float>(constexpr_exp(-(x * x) / (2.0 * s * s)) / sum);
+  }
+}
+
+// Up to 11 taps, padded to one 64-byte line like the cached copies
+struct KernelTable {
+  int size;
+  float sigma;
+  alignas(simd::kSimdAlignment) std::array<float, 16> weights;
+};
+
+constexpr KernelTable make_kernel_table(int size, float sigma) {
+  KernelTable table{size, sigma, {}};
+  fill_gaussian(size, sigma, table.weights);
+  return table;
+}
+
+// Sizes 3 to 11 at the sigmas the filters default to: (5, 1.5) for the blur,
+// (11, 2.0) for the Kuwahara pre-blur
+constexpr KernelTable kKernelTables[] = {
+    make_kernel_table(3, 1.0f),  make_kernel_table(3, 1.5f),
+    make_kernel_table(3, 2.0f),  make_kernel_table(5, 1.0f),
+    make_kernel_table(5, 1.5f),  make_kernel_table(5, 2.0f),
+    make_kernel_table(7, 1.0f),  make_kernel_table(7, 1.5f),
+    make_kernel_table(7, 2.0f),  make_kernel_table(9, 1.0f),
+    make_kernel_table(9, 1.5f),  make_kernel_table(9, 2.0f),
+    make_kernel_table(11, 1.0f), make_kernel_table(11, 1.5f),
+    make_kernel_table(11, 2.0f),
+};
+}  // namespace detail
+
+// Process-wide cache of Gaussian kernels keyed by (size, sigma, precision).
+// Safe to call from several threads; the kernels it hands out are immutable.
+class KernelCache {
+ public:
+  // Kernels have an odd number of taps, so an even size gets one more. A
+  // size below 1 is an error and gets the 1-tap kernel, which leaves pixels
+  // as they are.
+  static std::shared_ptr<const CachedKernel> gaussian(
+      int size, float sigma, KernelPrecision precision = KernelPrecision::f32) {
+    if (size < 1) {
+      std::cerr << "Kernel size must be positive, got " << size
+                << ". Using 1.\n";
+      size = 1;
+    } else if (size % 2 == 0) {
+      size += 1;
+    }
+
+    Registry& registry = get_registry();
+    const Key key{size, sigma, precision};
+
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto found = registry.entries.find(key);
+    if (found != registry.entries.end()) {
+      return found->second;
+    }
+
+    // Arbitrary sigmas would otherwise grow it without bound in long runs;
+    // callers holding a kernel keep it alive
+    if (registry.entries.size() >= kMaxEntries) {
+      registry.entries.clear();
+    }
+
+    auto kernel = build(size, sigma, precision);
+    registry.entries.emplace(key, kernel);
+    return kernel;
+  }
+
+  static void clear() {
+    Registry& registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.entries.clear();
+  }
+
+ private:
+  using Key = std::tuple<int, float, KernelPrecision>;
+
+  static constexpr size_t kMaxEntries = 256;
+
+  struct Registry {
+    std::mutex mutex;
+    std::map<Key, std::shared_ptr<const CachedKernel>> entries;
+  };
+
+  static Registry& get_registry() {
+    static Registry registry;
+    return registry;
+  }
+
+  static std::shared_ptr<const CachedKernel> build(int size, float sigma,
+                                                   KernelPrecision precision) {
+    auto kernel = std::make_shared<CachedKernel>();
+    kernel->size = size;
+    kernel->sigma = sigma;
+    kernel->precision = precision;
+
+    simd::AlignedVector<float> weights(simd::padded_stride<float>(size), 0.0f);
+    bool from_table = false;
+    for (const detail::KernelTable& table : detail::kKernelTables) {
+      if (table.size == size && table.sigma == sigma) {
+        std::copy(table.weights.begin(), table.weights.begin() + size,
+                  weights.begin());
+        from_table = true;
+        break;
+      }
+    }
+    if (!from_table) {
+      detail::fill_gaussian(size, sigma, weights);
+    }
+
+    if (precision == KernelPrecision::q14) {
+      const std::vector<int16_t> quantized = simd::quantize_weights(
+          std::vector<float>(weights.begin(), weights.begin() + size));
+      kernel->fixed_weights.assign(simd::padded_stride<int16_t>(size), 0);
+      std::copy(quantized.begin(), quantized.end(),
+                kernel->fixed_weights.begin());
+    } else {
+      kernel->weights = std::move(weights);
+    }
+
+    return kernel;
+  }
+};
+}  // namespace imgr
+
+#endif  // !IMGR_FILTER_KERNEL_CACHE_H
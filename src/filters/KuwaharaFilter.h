@@ -5,18 +5,65 @@
 
 #  include <omp.h>
 
+#  include <algorithm>
 #  include <cmath>
+#  include <cstdint>
 #  include <iostream>
 #  include <limits>
+#  include <utility>
 #  include <vector>
 
 #  include "../Image.h"
+#  include "../parallel.h"
+#  include "Border.h"
 #  include "GaussianBlur.h"
+#  include "KernelCache.h"
+#  include "../simd/convolve.h"
 
 namespace imgr {
+enum class KuwaharaEngine {
+  direct = 0,   // re-sums every region, O(window^2) per pixel
+  summed_area,  // integral images, four lookups per region
+  sliding,      // running column sums, O(1) updates, a few rows of memory
+  fused,        // pre-blur and summed areas per cache-sized tile, one pass
+  pyramid,      // regions picked on a coarser pyramid level, windows >= 31
+};
+
 class KuwaharaFilter {
  public:
-  static void apply_kuwara_filter(imgr::Image& image, int window_size = 7) {
+  // The image is first smoothed with a Gaussian of blur_sigma; 0 skips the
+  // pre-blur and filters the image as it is
+  static void apply_kuwara_filter(
+      ImageView image, int window_size = 7,
+      BorderMode border = BorderMode::clamp,
+      KuwaharaEngine engine = KuwaharaEngine::summed_area,
+      float blur_sigma = 2.0f) {
+    run(image, window_size, border, engine, blur_sigma, false);
+  }
+
+  // Rows are split across threads; per-pixel statistics live on the stack,
+  // so the hot loop never allocates
+  static void apply_kuwara_filter_parallel(
+      ImageView image, int window_size = 7,
+      BorderMode border = BorderMode::clamp,
+      KuwaharaEngine engine = KuwaharaEngine::summed_area,
+      float blur_sigma = 2.0f) {
+    run(image, window_size, border, engine, blur_sigma, true);
+  }
+
+  // 2.5 sigma each side, which gives the 11 taps the filter has always used
+  // at the default sigma of 2
+  static int blur_kernel_size(float blur_sigma) {
+    return static_cast<int>(2 * std::ceil(2.5f * blur_sigma) + 1);
+  }
+
+  // Regions are ranked on the variance summed over all channels of a pixel,
+  // so planar images are interleaved for the filter and back
+  static PixelLayout preferred_layout() { return PixelLayout::interleaved; }
+
+ private:
+  static void run(ImageView image, int window_size, BorderMode border,
+                  KuwaharaEngine engine, float blur_sigma, bool parallel) {
     if (window_size < 5 || window_size % 2 == 0) {
       std::cerr << "Invalid winsize " << window_size
                 << ": winsize must follow formula: w = 4*n+1.\n";
@@ -24,116 +71,791 @@ class KuwaharaFilter {
     }
 
     // NOTE: is this neccessary?
-    if (image.m_channels < 1) {
-      std::cerr << "Image has no channels to process.\n";
+    if (image.channels() < 1 || image.channels() > kMaxChannels) {
+      std::cerr << "Image must have 1 to " << kMaxChannels
+                << " channels to process.\n";
+      return;
+    }
+
+    if (image.planar()) {
+      with_interleaved(image, parallel, [&](ImageView pixels) {
+        run(pixels, window_size, border, engine, blur_sigma, parallel);
+      });
+      return;
+    }
+
+    const RegionLayout layout = region_layout(window_size);
+
+    std::cout << "computed values:\n"
+              << window_size << "," << layout.window_size_half << ","
+              << layout.num_regions << "," << layout.num_regions_sqrt << ","
+              << layout.region_size << "\n";
+
+    const bool blur = blur_sigma > 0.0f;
+
+    if (engine == KuwaharaEngine::pyramid &&
+        window_size < kMinPyramidWindow) {
+      engine = KuwaharaEngine::summed_area;
+    }
+
+    // Past this the 32-bit tables cannot hold a region's sum of squares;
+    // the sliding engine keeps 64-bit sums
+    if (layout.region_size > kMaxTableRegionSize &&
+        (engine == KuwaharaEngine::summed_area ||
+         engine == KuwaharaEngine::fused)) {
+      engine = KuwaharaEngine::sliding;
+    }
+
+    // A wrapped window can reach the far side of the image, so its tiles
+    // would need the whole image blurred; it takes the two-pass route
+    if (engine == KuwaharaEngine::fused && blur &&
+        border != BorderMode::wrap) {
+      fused_kuwahara(
+          image, layout,
+          *KernelCache::gaussian(blur_kernel_size(blur_sigma), blur_sigma),
+          border, parallel);
       return;
     }
 
-    // NOTE: maybe remove it and require gaussian blur? aka just kuwahara filter
-    // on it's own
-    imgr::GaussianBlur::apply_gaussian_blur_parallel(image, 2.0, 11);
+    if (blur) {
+      const int kernel_size = blur_kernel_size(blur_sigma);
+      if (parallel) {
+        imgr::GaussianBlur::apply_gaussian_blur_parallel(
+            image, blur_sigma, kernel_size, GaussianEngine::separable,
+            border);
+      } else {
+        imgr::GaussianBlur::apply_gaussian_blur(
+            image, blur_sigma, kernel_size, GaussianEngine::separable,
+            border);
+      }
+    }
+
+    // Reading from a padded copy lets the same loop cover the borders, and the
+    // result can go straight into the image
+    const Image padded =
+        pad_image(image, layout.window_size_half, border, parallel);
+
+    switch (engine) {
+    case KuwaharaEngine::pyramid:
+      pyramid_kuwahara(image, padded, window_size, layout, border, parallel);
+      break;
+    case KuwaharaEngine::fused:  // nothing to fuse, or a wrapped border
+    case KuwaharaEngine::summed_area:
+      summed_area_kuwahara(image, padded, layout, parallel);
+      break;
+    case KuwaharaEngine::sliding:
+      sliding_kuwahara(image, padded, layout, parallel);
+      break;
+    case KuwaharaEngine::direct:
+    default:
+      direct_kuwahara(image, padded, layout, parallel);
+      break;
+    }
+  }
+
+  static constexpr int kMaxChannels = 4;
+  static constexpr int kMaxRegions = 16;
 
-    Image filtered_image = image;
+  // The window is split into num_regions_sqrt^2 square regions of
+  // region_size pixels, whose top-left corners in padded coordinates are
+  // (x + dx * region_size, y + dy * region_size)
+  struct RegionLayout {
+    int window_size_half;
+    int num_regions;
+    int num_regions_sqrt;
+    int region_size;
+  };
 
-    int window_size_half = 0;
-    int num_regions = 0;
-    int num_regions_sqrt = 0;
-    int region_size = 0;
+  static RegionLayout region_layout(int window_size) {
+    RegionLayout layout{};
 
     switch (window_size) {
     case 5:
-      window_size_half = 2;
-      num_regions = 4;
-      num_regions_sqrt = 2;
+      layout.window_size_half = 2;
+      layout.num_regions = 4;
+      layout.num_regions_sqrt = 2;
       break;
     case 7:
-      window_size_half = 3;
-      num_regions = 9;
-      num_regions_sqrt = 3;
+      layout.window_size_half = 3;
+      layout.num_regions = 9;
+      layout.num_regions_sqrt = 3;
       break;
     default:
-      window_size_half = window_size / 2;
-      num_regions = 16;
-      num_regions_sqrt = 4;
+      layout.window_size_half = window_size / 2;
+      layout.num_regions = 16;
+      layout.num_regions_sqrt = 4;
       break;
     }
-    region_size = window_size / num_regions_sqrt;
+    layout.region_size = window_size / layout.num_regions_sqrt;
 
-    // const size_t window_size_half = window_size / 2;
-    // const size_t num_regions =
-    //     (window_size == 5) ? 4 : ((window_size == 7) ? 9 : 16);
-    // const size_t num_regions_sqrt = std::sqrt(num_regions);
+    return layout;
+  }
 
-    std::cout << "computed values:\n"
-              << window_size << "," << window_size_half << "," << num_regions
-              << "," << num_regions_sqrt << "," << region_size << "\n";
+  static void direct_kuwahara(ImageView image, const Image& padded,
+                              const RegionLayout& layout, bool parallel) {
+    const int channels = image.channels();
+    const int num_regions_sqrt = layout.num_regions_sqrt;
+    const int region_size = layout.region_size;
+    const int64_t area = static_cast<int64_t>(region_size) * region_size;
 
-    for (int y = window_size_half; y < image.m_height - window_size_half; y++) {
-      for (int x = window_size_half; x < image.m_width - window_size_half;
-           x++) {
-        std::vector<std::vector<double>> means(
-            num_regions, std::vector<double>(image.m_channels, 0.0));
-        std::vector<std::vector<double>> variances(
-            num_regions, std::vector<double>(image.m_channels, 0.0));
+    parallel_for_rows(0, image.height(), parallel, [&](int y) {
+      for (int x = 0; x < image.width(); x++) {
+        int64_t sums[kMaxRegions][kMaxChannels];
+        int64_t best_key = std::numeric_limits<int64_t>::max();
+        int best_region = 0;
 
         int region_idx = 0;
-
         for (int dy = 0; dy < num_regions_sqrt; dy++) {
           for (int dx = 0; dx < num_regions_sqrt; dx++) {
-            int start_region_x = x - window_size_half + dx * region_size;
-            int start_region_y = y - window_size_half + dy * region_size;
+            // Padded coordinates: (x, y) sits at (x + half, y + half)
+            const int start_region_x = x + dx * region_size;
+            const int start_region_y = y + dy * region_size;
 
-            std::vector<double> sums(image.m_channels, 0.0);
-            std::vector<double> sums_squared(image.m_channels, 0.0);
+            int64_t* region_sums = sums[region_idx];
+            int64_t sums_squared[kMaxChannels] = {};
+            std::fill(region_sums, region_sums + channels, 0);
 
             for (int py = start_region_y; py < start_region_y + region_size;
                  py++) {
-              for (int px = start_region_x; px < start_region_x + region_size;
-                   px++) {
-                const int idx = (py * image.m_width + px) * image.m_channels;
-
-                for (int channel = 0; channel < image.m_channels; channel++) {
-                  const double pixel_value = image.m_data[idx + channel];
-                  sums[channel] += pixel_value;
+              const uint8_t* row =
+                  padded.m_data.data() +
+                  (static_cast<size_t>(py) * padded.m_width + start_region_x) *
+                      channels;
+              for (int i = 0; i < region_size; i++) {
+                for (int channel = 0; channel < channels; channel++) {
+                  const int64_t pixel_value = row[i * channels + channel];
+                  region_sums[channel] += pixel_value;
                   sums_squared[channel] += pixel_value * pixel_value;
                 }
               }
             }
 
-            double area = region_size * region_size;
-            for (int channel = 0; channel < image.m_channels; channel++) {
-              means[region_idx][channel] = sums[channel] / area;
-              variances[region_idx][channel] =
-                  (sums_squared[channel] / area) -
-                  (means[region_idx][channel] * means[region_idx][channel]);
+            int64_t key = 0;
+            for (int channel = 0; channel < channels; channel++) {
+              key += variance_key(region_sums[channel], sums_squared[channel],
+                                  area);
+            }
+
+            if (key < best_key) {
+              best_key = key;
+              best_region = region_idx;
             }
             region_idx++;
           }
         }
 
-        int best_region = 0;
-        double min_vatriance = std::numeric_limits<double>::max();
-        for (int i = 0; i < num_regions; i++) {
-          double total_variance = 0.0;
-          for (int channel = 0; channel < image.m_channels; channel++) {
-            total_variance += variances[i][channel];
+        uint8_t* dst = image.row(y) + x * channels;
+        for (int channel = 0; channel < channels; channel++) {
+          dst[channel] =
+              static_cast<uint8_t>(sums[best_region][channel] / area);
+        }
+      }
+    });
+  }
+
+  // Integral images of the padded values and of their squares, one plane
+  // per channel so a row of windows reads contiguous entries: entry (y, x)
+  // of a plane holds the sums over rows [0, y) and columns [0, x). Entries
+  // are uint32 and may wrap, but a region sum is a difference of four
+  // entries and so is exact modulo 2^32, which holds the sum of squares of
+  // any region up to kMaxTableRegionSize pixels wide.
+  struct SummedAreaTables {
+    int stride = 0;    // entries per row, padded width + 1
+    size_t plane = 0;  // entries per channel plane
+    std::vector<uint32_t> sums;
+    std::vector<uint32_t> squares;
+  };
+
+  static constexpr int kMaxTableRegionSize = 257;
+
+  static SummedAreaTables build_summed_area_tables(const Image& padded,
+                                                   bool parallel) {
+    SummedAreaTables tables;
+    build_summed_area_tables(padded.m_data.data(), padded.m_width,
+                             padded.m_height, padded.m_channels, parallel,
+                             tables);
+    return tables;
+  }
+
+  // Fills `tables` for a width x height interleaved buffer, reusing its
+  // storage. Without `squares` only the sums are built, enough for means.
+  static void build_summed_area_tables(const uint8_t* data, int width,
+                                       int height, int channels,
+                                       bool parallel,
+                                       SummedAreaTables& tables,
+                                       bool squares = true) {
+    const int stride = width + 1;
+    const size_t plane = static_cast<size_t>(stride) * (height + 1);
+
+    tables.stride = stride;
+    tables.plane = plane;
+    tables.sums.assign(plane * channels, 0);
+    tables.squares.assign(squares ? plane * channels : 0, 0);
+
+    // Running sums along each row
+#  pragma omp parallel for if (parallel)
+    for (int y = 0; y < height; ++y) {
+      const uint8_t* src = data + static_cast<size_t>(y) * width * channels;
+
+      for (int c = 0; c < channels; ++c) {
+        const size_t row = c * plane + static_cast<size_t>(y + 1) * stride;
+        uint32_t* sums = tables.sums.data() + row;
+        uint32_t sum = 0;
+        for (int x = 0; x < width; ++x) {
+          sum += src[x * channels + c];
+          sums[x + 1] = sum;
+        }
+
+        if (squares) {
+          uint32_t* row_squares = tables.squares.data() + row;
+          uint32_t square = 0;
+          for (int x = 0; x < width; ++x) {
+            const uint32_t value = src[x * channels + c];
+            square += value * value;
+            row_squares[x + 1] = square;
           }
-          if (total_variance < min_vatriance) {
-            min_vatriance = total_variance;
-            best_region = i;
+        }
+      }
+    }
+
+    // Then down the columns, a block of columns at a time so the adds run
+    // along contiguous entries
+    constexpr int kBlock = 256;
+    const int blocks = (stride + kBlock - 1) / kBlock;
+
+#  pragma omp parallel for if (parallel)
+    for (int task = 0; task < channels * blocks; ++task) {
+      const int begin = (task % blocks) * kBlock;
+      const int end = std::min(stride, begin + kBlock);
+      const size_t first = (task / blocks) * plane;
+
+      for (int t = 0; t < (squares ? 2 : 1); ++t) {
+        uint32_t* table = t == 0 ? tables.sums.data() : tables.squares.data();
+        for (int y = 1; y <= height; ++y) {
+          uint32_t* row = table + first + static_cast<size_t>(y) * stride;
+
+#  pragma omp simd
+          for (int i = begin; i < end; ++i) {
+            row[i] += row[i - stride];
           }
         }
+      }
+    }
+  }
 
-        int filtered_idx = (y * image.m_width + x) * image.m_channels;
+  // area^2 times the variance of a region with these integer sums. Exact,
+  // so every engine ranks regions the same way, and ties go to the first
+  // region as they always have.
+  static int64_t variance_key(int64_t sum, int64_t sum_squared,
+                              int64_t area) {
+    return area * sum_squared - sum * sum;
+  }
+
+  static constexpr int kSelectChunk = 64;
+
+  // Index of the lowest-variance region of `chunk` (at most kSelectChunk)
+  // consecutive windows starting at table entry (y, x0). Works region by
+  // region and channel by channel, so every inner loop runs across x over
+  // contiguous entries.
+  static void rank_regions(const SummedAreaTables& tables, int y, int x0,
+                           int chunk, const RegionLayout& layout,
+                           int channels, int* best_regions) {
+    const int n = layout.num_regions_sqrt;
+    const int region_size = layout.region_size;
+    const int64_t area = static_cast<int64_t>(region_size) * region_size;
+    const size_t down = static_cast<size_t>(region_size) * tables.stride;
+
+    int64_t best_keys[kSelectChunk];
+    std::fill(best_keys, best_keys + chunk,
+              std::numeric_limits<int64_t>::max());
+    std::fill(best_regions, best_regions + chunk, 0);
+
+    for (int region = 0; region < n * n; ++region) {
+      const size_t top_left =
+          static_cast<size_t>(y + region / n * region_size) * tables.stride +
+          x0 + region % n * region_size;
+      int64_t keys[kSelectChunk] = {};
+
+      for (int c = 0; c < channels; ++c) {
+        const uint32_t* top = tables.sums.data() + c * tables.plane + top_left;
+        const uint32_t* bottom = top + down;
+        const uint32_t* top_squares =
+            tables.squares.data() + c * tables.plane + top_left;
+        const uint32_t* bottom_squares = top_squares + down;
 
-        for (int channel = 0; channel < image.m_channels; channel++) {
-          filtered_image.m_data[filtered_idx + channel] =
-              static_cast<uint8_t>(means[best_region][channel]);
+#  pragma omp simd
+        for (int i = 0; i < chunk; ++i) {
+          const uint32_t sum = bottom[i + region_size] - bottom[i] -
+                               top[i + region_size] + top[i];
+          const uint32_t sum_squared =
+              bottom_squares[i + region_size] - bottom_squares[i] -
+              top_squares[i + region_size] + top_squares[i];
+          keys[i] += variance_key(sum, sum_squared, area);
         }
       }
+
+#  pragma omp simd
+      for (int i = 0; i < chunk; ++i) {
+        if (keys[i] < best_keys[i]) {
+          best_keys[i] = keys[i];
+          best_regions[i] = region;
+        }
+      }
+    }
+  }
+
+  // Mean of one region of the window starting at table entry (y, x),
+  // truncated like the original double division. Only needs the sums.
+  static void write_region_mean(const SummedAreaTables& tables, int y, int x,
+                                int region, const RegionLayout& layout,
+                                int channels, uint8_t* dst) {
+    const int n = layout.num_regions_sqrt;
+    const int region_size = layout.region_size;
+    const uint32_t area = static_cast<uint32_t>(region_size) * region_size;
+    const size_t down = static_cast<size_t>(region_size) * tables.stride;
+    const size_t at =
+        static_cast<size_t>(y + region / n * region_size) * tables.stride + x +
+        region % n * region_size;
+
+    for (int c = 0; c < channels; ++c) {
+      const uint32_t* sums = tables.sums.data() + c * tables.plane + at;
+      const uint32_t sum =
+          sums[down + region_size] - sums[down] - sums[region_size] + sums[0];
+      dst[c] = static_cast<uint8_t>(sum / area);
+    }
+  }
+
+  // Writes `count` pixels whose windows start at table entries (y, 0) to
+  // (y, count - 1), a chunk of pixels at a time
+  static void select_row(const SummedAreaTables& tables, int y, int count,
+                         const RegionLayout& layout, int channels,
+                         uint8_t* dst) {
+    for (int x0 = 0; x0 < count; x0 += kSelectChunk) {
+      const int chunk = std::min(kSelectChunk, count - x0);
+      int best_regions[kSelectChunk];
+      rank_regions(tables, y, x0, chunk, layout, channels, best_regions);
+
+      for (int i = 0; i < chunk; ++i) {
+        write_region_mean(tables, y, x0 + i, best_regions[i], layout, channels,
+                          dst + (x0 + i) * channels);
+      }
     }
+  }
+
+  static void summed_area_kuwahara(ImageView image, const Image& padded,
+                                   const RegionLayout& layout, bool parallel) {
+    const int channels = image.channels();
+    const SummedAreaTables tables =
+        build_summed_area_tables(padded, parallel);
+
+    parallel_for_rows(0, image.height(), parallel, [&](int y) {
+      select_row(tables, y, image.width(), layout, channels, image.row(y));
+    });
+  }
 
-    image = filtered_image;
+  // Each band of rows keeps, for every vertical region offset dy, the sums
+  // of region_size padded rows per column. Moving down a row adds one row
+  // and drops one; along a row the region sums slide the same way, adding
+  // one column and dropping one. Memory is a few rows per band instead of
+  // two image-sized tables. Sums are exact integers, so the output is
+  // identical to direct_kuwahara.
+  static void sliding_kuwahara(ImageView image, const Image& padded,
+                               const RegionLayout& layout, bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+    const int n = layout.num_regions_sqrt;
+    const int region_size = layout.region_size;
+    const int padded_stride = padded.m_width * channels;
+    // Region starts along a padded row, times channels
+    const int starts = (padded.m_width - region_size + 1) * channels;
+    const int window = region_size * channels;
+    const int64_t area = static_cast<int64_t>(region_size) * region_size;
+
+    // Every band pays region_size rows of setup per offset, so bands are
+    // kept several windows tall
+    const int threads = parallel ? omp_get_max_threads() : 1;
+    const int num_bands = std::max(
+        1, std::min(4 * threads, height / (4 * n * region_size)));
+
+    parallel_for_rows(0, num_bands, parallel, [&](int band) {
+      const int y_begin = static_cast<int>(static_cast<int64_t>(height) *
+                                           band / num_bands);
+      const int y_end = static_cast<int>(static_cast<int64_t>(height) *
+                                         (band + 1) / num_bands);
+
+      std::vector<int64_t> column_sums(static_cast<size_t>(n) * padded_stride,
+                                       0);
+      std::vector<int64_t> column_squares(column_sums.size(), 0);
+      std::vector<int64_t> region_sums(static_cast<size_t>(n) * starts);
+      std::vector<int64_t> region_squares(region_sums.size());
+
+      auto add_row = [&](int dy, int py, int sign) {
+        const uint8_t* row =
+            padded.m_data.data() + static_cast<size_t>(py) * padded_stride;
+        int64_t* sums = column_sums.data() +
+                        static_cast<size_t>(dy) * padded_stride;
+        int64_t* squares = column_squares.data() +
+                           static_cast<size_t>(dy) * padded_stride;
+        for (int i = 0; i < padded_stride; ++i) {
+          const int64_t value = row[i];
+          sums[i] += sign * value;
+          squares[i] += sign * value * value;
+        }
+      };
+
+      for (int dy = 0; dy < n; ++dy) {
+        const int top = y_begin + dy * region_size;
+        for (int py = top; py < top + region_size; ++py) {
+          add_row(dy, py, 1);
+        }
+      }
+
+      for (int y = y_begin; y < y_end; y++) {
+        for (int dy = 0; dy < n; ++dy) {
+          if (y > y_begin) {
+            const int top = y - 1 + dy * region_size;
+            add_row(dy, top, -1);
+            add_row(dy, top + region_size, 1);
+          }
+
+          const int64_t* sums =
+              column_sums.data() + static_cast<size_t>(dy) * padded_stride;
+          const int64_t* squares =
+              column_squares.data() + static_cast<size_t>(dy) * padded_stride;
+          int64_t* out_sums =
+              region_sums.data() + static_cast<size_t>(dy) * starts;
+          int64_t* out_squares =
+              region_squares.data() + static_cast<size_t>(dy) * starts;
+
+          for (int c = 0; c < channels; ++c) {
+            int64_t sum = 0;
+            int64_t square = 0;
+            for (int i = c; i < window; i += channels) {
+              sum += sums[i];
+              square += squares[i];
+            }
+            out_sums[c] = sum;
+            out_squares[c] = square;
+          }
+          for (int i = channels; i < starts; ++i) {
+            out_sums[i] = out_sums[i - channels] + sums[i + window - channels] -
+                          sums[i - channels];
+            out_squares[i] = out_squares[i - channels] +
+                             squares[i + window - channels] -
+                             squares[i - channels];
+          }
+        }
+
+        for (int x = 0; x < width; x++) {
+          int64_t best_key = std::numeric_limits<int64_t>::max();
+          size_t best_at = 0;
+
+          for (int dy = 0; dy < n; dy++) {
+            for (int dx = 0; dx < n; dx++) {
+              const size_t at = static_cast<size_t>(dy) * starts +
+                                static_cast<size_t>(x + dx * region_size) *
+                                    channels;
+
+              int64_t key = 0;
+              for (int channel = 0; channel < channels; channel++) {
+                key += variance_key(region_sums[at + channel],
+                                    region_squares[at + channel], area);
+              }
+
+              if (key < best_key) {
+                best_key = key;
+                best_at = at;
+              }
+            }
+          }
+
+          uint8_t* dst = image.row(y) + x * channels;
+          for (int channel = 0; channel < channels; channel++) {
+            dst[channel] =
+                static_cast<uint8_t>(region_sums[best_at + channel] / area);
+          }
+        }
+      }
+    });
+  }
+
+  // Output tile edge of the fused engine. With the window and blur halos the
+  // float scratch and tile-local tables of an RGB tile come to about 1 MB at
+  // small windows, within L2, and the halos stay a modest share of the work.
+  static constexpr int kFusedTileSize = 128;
+
+  // Smallest interval [first, last] of source indices a table maps
+  // [begin, end) to. Clamp, mirror and constant borders only reach pixels
+  // near the tile, so the interval stays small.
+  static std::pair<int, int> source_span(const BorderTable& table, int begin,
+                                         int end) {
+    int first = table.size;
+    int last = -1;
+    for (int i = begin; i < end; ++i) {
+      const int source = table(i);
+      if (source >= 0) {
+        first = std::min(first, source);
+        last = std::max(last, source);
+      }
+    }
+    return {first, last};
+  }
+
+  // Pre-blur, padding and statistics per tile instead of per image: each
+  // tile blurs just the pixels its windows read into scratch, lays out its
+  // padded window from them and builds summed-area tables of that alone.
+  // The blur uses the same row kernels, border tables and 8-bit store as
+  // the separable engine, so the output is identical to blurring the whole
+  // image and running summed_area_kuwahara, without writing the blurred
+  // image, copying it into a padded image or building image-sized tables.
+  static void fused_kuwahara(ImageView image, const RegionLayout& layout,
+                             const CachedKernel& kernel, BorderMode border,
+                             bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+    const int half = layout.window_size_half;
+    const int kernel_size = kernel.size;
+    const int radius = kernel_size / 2;
+
+    // Window lookups happen on the blurred image, blur taps on the source
+    const BorderTable window_columns = make_border_table(width, half, border);
+    const BorderTable window_rows = make_border_table(height, half, border);
+    const BorderTable blur_columns = make_border_table(width, radius, border);
+    const BorderTable blur_rows = make_border_table(height, radius, border);
+
+    // Tiles read their halo from the source, so results go to a second
+    // buffer
+    OutOfPlace pass(image);
+    const ConstImageView& source = pass.source();
+    const ImageView& target = pass.target();
+
+    const int tiles_x = (width + kFusedTileSize - 1) / kFusedTileSize;
+    const int tiles_y = (height + kFusedTileSize - 1) / kFusedTileSize;
+    const int num_tiles = tiles_x * tiles_y;
+
+    // A tile's windows read at most their own extent of blurred pixels, as
+    // clamped, mirrored and constant borders stay near the tile (wrapped
+    // ones never get here), and never more than the image holds
+    const int max_window_width = std::min(width, kFusedTileSize) + 2 * half;
+    const int max_window_height = std::min(height, kFusedTileSize) + 2 * half;
+    const int max_blurred_width = std::min(width, max_window_width);
+    const int max_blurred_height = std::min(height, max_window_height);
+    const int max_n = max_blurred_width * channels;
+
+#  pragma omp parallel if (parallel)
+    {
+      // Per-thread scratch for the largest tile, reused across tiles. Rows
+      // are padded to whole cache lines for the vertical pass.
+      std::vector<float> padded((max_blurred_width + 2 * radius) * channels);
+      simd::AlignedVector<float> horizontal(
+          simd::padded_stride<float>(max_n) *
+          (max_blurred_height + 2 * radius));
+      std::vector<uint8_t> blurred(static_cast<size_t>(max_n) *
+                                   max_blurred_height);
+      std::vector<float> acc(max_n);
+      std::vector<const float*> row_pointers(kernel_size);
+      std::vector<uint8_t> window(static_cast<size_t>(max_window_width) *
+                                  max_window_height * channels);
+      SummedAreaTables tables;
+
+#  pragma omp for schedule(guided)
+      for (int tile = 0; tile < num_tiles; ++tile) {
+        const int x0 = (tile % tiles_x) * kFusedTileSize;
+        const int y0 = (tile / tiles_x) * kFusedTileSize;
+        const int tw = std::min(kFusedTileSize, width - x0);
+        const int th = std::min(kFusedTileSize, height - y0);
+
+        // Blurred pixels the padded windows of this tile read
+        const auto [bx0, bx1] =
+            source_span(window_columns, x0 - half, x0 + tw + half);
+        const auto [by0, by1] =
+            source_span(window_rows, y0 - half, y0 + th + half);
+        const int blurred_width = bx1 - bx0 + 1;
+        const int blurred_height = by1 - by0 + 1;
+        const int n = blurred_width * channels;
+
+        // Horizontal pass over those rows and the vertical blur halo
+        const size_t row = simd::padded_stride<float>(n);
+        for (int y = by0 - radius; y <= by1 + radius; ++y) {
+          float* dst = horizontal.data() + (y - by0 + radius) * row;
+          const int source_row = blur_rows(y);
+          if (source_row < 0) {
+            std::fill(dst, dst + n, 0.0f);
+            continue;
+          }
+
+          const uint8_t* src = source.row(source_row);
+          for (int x = bx0 - radius; x <= bx1 + radius; ++x) {
+            const int column = blur_columns(x);
+            for (int c = 0; c < channels; ++c) {
+              padded[(x - bx0 + radius) * channels + c] =
+                  column < 0 ? 0.0f : src[column * channels + c];
+            }
+          }
+          simd::convolve_row(padded.data(), dst, n, kernel.weights.data(),
+                             kernel_size, channels);
+        }
+
+        // Vertical pass, truncated to 8 bits like the standalone blur
+        for (int y = 0; y < blurred_height; ++y) {
+          for (int k = 0; k < kernel_size; ++k) {
+            row_pointers[k] = horizontal.data() + (y + k) * row;
+          }
+          simd::convolve_columns(row_pointers.data(), acc.data(), n,
+                                 kernel.weights.data(), kernel_size);
+          uint8_t* dst = blurred.data() + static_cast<size_t>(y) * n;
+          for (int i = 0; i < n; ++i) {
+            dst[i] = static_cast<uint8_t>(
+                std::min(255.0f, std::max(0.0f, acc[i])));
+          }
+        }
+
+        // The tile's part of the padded blurred image
+        const int window_width = tw + 2 * half;
+        const int window_height = th + 2 * half;
+        std::fill_n(window.begin(),
+                    static_cast<size_t>(window_width) * window_height *
+                        channels,
+                    uint8_t{0});
+        for (int py = 0; py < window_height; ++py) {
+          const int source_row = window_rows(y0 - half + py);
+          if (source_row < 0) {
+            continue;  // constant border, already zero
+          }
+          const uint8_t* src =
+              blurred.data() + static_cast<size_t>(source_row - by0) * n;
+          uint8_t* dst = window.data() +
+                         static_cast<size_t>(py) * window_width * channels;
+          for (int px = 0; px < window_width; ++px) {
+            const int column = window_columns(x0 - half + px);
+            if (column < 0) {
+              continue;
+            }
+            for (int c = 0; c < channels; ++c) {
+              dst[px * channels + c] = src[(column - bx0) * channels + c];
+            }
+          }
+        }
+
+        build_summed_area_tables(window.data(), window_width, window_height,
+                                 channels, false, tables);
+
+        for (int y = 0; y < th; ++y) {
+          select_row(tables, y, tw, layout, channels,
+                     target.row(y0 + y) + x0 * channels);
+        }
+      }
+    }
+
+    pass.finish();
+  }
+
+  // Smallest window the pyramid engine takes; below it the full-resolution
+  // engines are already cheap and the coarse decision would show
+  static constexpr int kMinPyramidWindow = 31;
+  // Narrowest window worth ranking regions on at a coarse level
+  static constexpr int kMinLevelWindow = 15;
+
+  // Deepest level at which the window still spans kMinLevelWindow pixels:
+  // 1 for windows 31 to 61, 2 from 63, and so on
+  static int pyramid_level(int window_size) {
+    int level = 0;
+    while ((window_size >> (level + 1)) >= kMinLevelWindow) {
+      ++level;
+    }
+    return level;
+  }
+
+  // One level down the pyramid: each pixel is the rounded mean of a 2x2
+  // block, the last row or column repeated on odd sizes. The pre-blur has
+  // already removed what would alias at half resolution, so the box is
+  // enough to reduce, and reads each pixel once.
+  static Image pyramid_down(ConstImageView image, bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+
+    Image down;
+    down.allocate((width + 1) / 2, (height + 1) / 2, channels);
+
+    parallel_for_rows(0, down.m_height, parallel, [&](int y) {
+      const uint8_t* top = image.row(2 * y);
+      const uint8_t* bottom = 2 * y + 1 < height ? image.row(2 * y + 1) : top;
+      uint8_t* dst = down.row(y);
+
+      for (int x = 0; x < down.m_width; ++x) {
+        const int left = 2 * x * channels;
+        const int right = 2 * x + 1 < width ? left + channels : left;
+        for (int c = 0; c < channels; ++c) {
+          dst[x * channels + c] = static_cast<uint8_t>(
+              (top[left + c] + top[right + c] + bottom[left + c] +
+               bottom[right + c] + 2) /
+              4);
+        }
+      }
+    });
+
+    return down;
+  }
+
+  // Ranks the regions on a pyramid level where the window is about
+  // kMinLevelWindow pixels, so the variance work, and the tables of squares
+  // it needs, shrink by 4 per level. Each pixel then takes its coarse
+  // pixel's winning region and averages that region at full resolution,
+  // which needs only the tables of sums. Edges move by up to 2^level - 1
+  // pixels compared to sat.
+  static void pyramid_kuwahara(ImageView image, const Image& padded,
+                               int window_size, const RegionLayout& layout,
+                               BorderMode border, bool parallel) {
+    const int width = image.width();
+    const int height = image.height();
+    const int channels = image.channels();
+    const int level = pyramid_level(window_size);
+
+    Image coarse = pyramid_down(image, parallel);
+    for (int l = 1; l < level; ++l) {
+      coarse = pyramid_down(coarse, parallel);
+    }
+
+    // Same 4x4 grid of regions, scaled down with the image
+    const RegionLayout coarse_layout =
+        region_layout((window_size >> level) | 1);
+    const SummedAreaTables coarse_tables = build_summed_area_tables(
+        pad_image(coarse, coarse_layout.window_size_half, border, parallel),
+        parallel);
+
+    std::vector<uint8_t> decisions(static_cast<size_t>(coarse.m_width) *
+                                   coarse.m_height);
+    parallel_for_rows(0, coarse.m_height, parallel, [&](int y) {
+      uint8_t* row =
+          decisions.data() + static_cast<size_t>(y) * coarse.m_width;
+      for (int x0 = 0; x0 < coarse.m_width; x0 += kSelectChunk) {
+        const int chunk = std::min(kSelectChunk, coarse.m_width - x0);
+        int best_regions[kSelectChunk];
+        rank_regions(coarse_tables, y, x0, chunk, coarse_layout, channels,
+                     best_regions);
+        for (int i = 0; i < chunk; ++i) {
+          row[x0 + i] = static_cast<uint8_t>(best_regions[i]);
+        }
+      }
+    });
+
+    SummedAreaTables tables;
+    build_summed_area_tables(padded.m_data.data(), padded.m_width,
+                             padded.m_height, channels, parallel, tables,
+                             false);
+
+    parallel_for_rows(0, height, parallel, [&](int y) {
+      const uint8_t* coarse_row =
+          decisions.data() + static_cast<size_t>(y >> level) * coarse.m_width;
+      uint8_t* dst = image.row(y);
+      for (int x = 0; x < width; ++x) {
+        write_region_mean(tables, y, x, coarse_row[x >> level], layout,
+                          channels, dst + x * channels);
+      }
+    });
   }
 };
 }  // namespace imgr
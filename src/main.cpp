@@ -1,19 +1,23 @@
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
 
 #include "Image.h"
+#include "filters/AnisotropicKuwahara.h"
 #include "filters/GaussianBlur.h"
 #include "filters/GrayScale.h"
 #include "filters/KuwaharaFilter.h"
 
-enum flags { e = 1, o, f, h, i, p };
+enum flags { e = 1, o, f, h, i, p, m, b, k, w, g, s, r };
 
 enum filters_enum {
   gaussian_blur = 0,
   grayscale,
   kuwahara,
+  anisotropic_kuwahara,
 };
 
 // TODO: Change to array or std::array of strings (add overload utils.h)
@@ -28,8 +32,58 @@ const std::vector<std::string> valid_filters = {
     "gaussian_blur",
     "grayscale",
     "kuwahara",
+    "anisotropic_kuwahara",
 };
 
+// Order must match imgr::GaussianEngine
+const std::vector<std::string> valid_blur_modes = {
+    "direct",
+    "separable",
+    "recursive",
+    "box",
+    "fixed",
+    "tiled",
+    "auto",
+};
+
+// Order must match imgr::KuwaharaEngine
+const std::vector<std::string> valid_kuwahara_engines = {
+    "direct",
+    "sat",
+    "sliding",
+    "fused",
+    "pyramid",
+};
+
+// Order must match imgr::GrayscaleMode
+const std::vector<std::string> valid_gray_modes = {
+    "bt601",
+    "bt709",
+    "average",
+    "max",
+};
+
+// Order must match imgr::BorderMode
+const std::vector<std::string> valid_border_modes = {
+    "clamp",
+    "mirror",
+    "wrap",
+    "constant",
+};
+
+// Index of the value after '=' in `options`, or -1 if it is not there
+static int parse_option_value(const std::string& arg,
+                              const std::vector<std::string>& options) {
+  const std::string value = arg.substr(arg.find_first_of('=') + 1);
+
+  auto iter = std::find(options.begin(), options.end(), value);
+  if (iter == options.end()) {
+    return -1;
+  }
+
+  return static_cast<int>(std::distance(options.begin(), iter));
+}
+
 int main(int argc, char* argv[]) {
   std::cout << "Welcome to Imagerio!\n";
 
@@ -54,12 +108,59 @@ int main(int argc, char* argv[]) {
               << "\t\t gaussian_blur - blur image with gaussian blur\n"
               << "\t\t grayscale     - make image gray\n"
               << "\t\t kuwahara      - kuwahara filter\n"
+              << "\t\t anisotropic_kuwahara - kuwahara filter following "
+                 "local edge orientation\n"
               << "\t-h or -help       list of commmands \n"
               << "\t-i or -image      image file name and path example: "
                  "./folder/image.png or "
                  "C:\\Users\\WindowsUser\\Pictures\\image.png \n"
               << "\t-p or -parllel    set the program to use "
-                 "multi-threading \n\n";
+                 "multi-threading \n"
+              << "\t-m=<mode> or -mode=<mode>     gaussian blur engine\n"
+              << "\tsupported modes:\n"
+              << "\t\t direct        - full 2D kernel, FFT for large "
+                 "kernels\n"
+              << "\t\t separable     - two 1D passes (default)\n"
+              << "\t\t recursive     - IIR approximation, constant time "
+                 "per pixel\n"
+              << "\t\t box           - box passes approximation, constant "
+                 "time per pixel\n"
+              << "\t\t fixed         - separable on 8-bit fixed-point "
+                 "integers\n"
+              << "\t\t tiled         - separable in cache-sized tiles\n"
+              << "\t\t auto          - fastest engine by a calibrated cost "
+                 "model\n"
+              << "\t-b=<border> or -border=<border>     how pixels past the "
+                 "edges are filled\n"
+              << "\tsupported borders:\n"
+              << "\t\t clamp         - repeat the edge pixel (default)\n"
+              << "\t\t mirror        - reflect around the edge pixel\n"
+              << "\t\t wrap          - continue from the opposite edge\n"
+              << "\t\t constant      - black\n"
+              << "\t-k=<engine> or -kuwahara=<engine>     kuwahara engine\n"
+              << "\tsupported engines:\n"
+              << "\t\t direct        - sum every region for every pixel\n"
+              << "\t\t sat           - summed-area tables, cost independent "
+                 "of window (default)\n"
+              << "\t\t sliding       - running sums, cost independent of "
+                 "window, little memory\n"
+              << "\t\t fused         - pre-blur and sums per cached tile, "
+                 "one pass\n"
+              << "\t\t pyramid       - regions picked at lower resolution, "
+                 "windows from 31\n"
+              << "\t-w=<size> or -window=<size>         kuwahara window, odd, "
+                 "from 5 (default 7), for anisotropic_kuwahara from 3 "
+                 "(default 13)\n"
+              << "\t-g=<mode> or -gray=<mode>           grayscale mode\n"
+              << "\tsupported modes:\n"
+              << "\t\t bt601         - SDTV / JPEG luma weights (default)\n"
+              << "\t\t bt709         - HDTV / sRGB luma weights\n"
+              << "\t\t average       - mean of R, G and B\n"
+              << "\t\t max           - brightest of R, G and B\n"
+              << "\t-s or -single     grayscale to a single-channel image "
+                 "(gray + alpha with alpha)\n"
+              << "\t-r=<x,y,w,h> or -region=<x,y,w,h>   filter only this "
+                 "rectangle, in place\n\n";
 
     return -1;
   }
@@ -69,6 +170,14 @@ int main(int argc, char* argv[]) {
   filters_enum filter = filters_enum::gaussian_blur;
   bool earlyexit = false;
   bool parallel_impl = false;
+  imgr::GaussianEngine blur_engine = imgr::GaussianEngine::separable;
+  imgr::BorderMode border = imgr::BorderMode::clamp;
+  imgr::KuwaharaEngine kuwahara_engine = imgr::KuwaharaEngine::summed_area;
+  int kuwahara_window = 0;  // until -w, each filter's default
+  imgr::GrayscaleMode gray_mode = imgr::GrayscaleMode::bt601;
+  imgr::GrayscaleOutput gray_output = imgr::GrayscaleOutput::rgb;
+  bool use_region = false;
+  int region[4] = {0, 0, 0, 0};  // x, y, width, height
 
   for (int x = 1; x < argc;) {
     if (earlyexit) {
@@ -84,7 +193,21 @@ int main(int argc, char* argv[]) {
         (starts_with("-i", argv[x]) || starts_with("-image", argv[x])) *
             flags::i +
         (starts_with("-p", argv[x]) || starts_with("-parallel", argv[x])) *
-            flags::p;
+            flags::p +
+        (starts_with(argv[x], "-m=") || starts_with(argv[x], "-mode=")) *
+            flags::m +
+        (starts_with(argv[x], "-b=") || starts_with(argv[x], "-border=")) *
+            flags::b +
+        (starts_with(argv[x], "-k=") || starts_with(argv[x], "-kuwahara=")) *
+            flags::k +
+        (starts_with(argv[x], "-w=") || starts_with(argv[x], "-window=")) *
+            flags::w +
+        (starts_with(argv[x], "-g=") || starts_with(argv[x], "-gray=")) *
+            flags::g +
+        (starts_with("-s", argv[x]) || starts_with("-single", argv[x])) *
+            flags::s +
+        (starts_with(argv[x], "-r=") || starts_with(argv[x], "-region=")) *
+            flags::r;
 
     if (flag == 0) {
       std::cerr << "Invaild Input enter -h or -help if you need help\n";
@@ -144,6 +267,82 @@ int main(int argc, char* argv[]) {
       x += 1;
 
       break;
+    case flags::m: {
+      const int idx = parse_option_value(argv[x], valid_blur_modes);
+      if (idx >= 0) {
+        blur_engine = imgr::GaussianEngine(idx);
+      } else {
+        std::cerr << "Invalid blur mode! Using separable as default\n";
+      }
+
+      x += 1;
+      break;
+    }
+    case flags::b: {
+      const int idx = parse_option_value(argv[x], valid_border_modes);
+      if (idx >= 0) {
+        border = imgr::BorderMode(idx);
+      } else {
+        std::cerr << "Invalid border mode! Using clamp as default\n";
+      }
+
+      x += 1;
+      break;
+    }
+    case flags::k: {
+      const int idx = parse_option_value(argv[x], valid_kuwahara_engines);
+      if (idx >= 0) {
+        kuwahara_engine = imgr::KuwaharaEngine(idx);
+      } else {
+        std::cerr << "Invalid kuwahara engine! Using sat as default\n";
+      }
+
+      x += 1;
+      break;
+    }
+    case flags::w: {
+      const std::string value = argv[x];
+      const int size = std::atoi(value.substr(value.find('=') + 1).c_str());
+      if (size >= 3 && size % 2 == 1) {
+        kuwahara_window = size;
+      } else {
+        std::cerr << "Invalid kuwahara window! Using the filter's default\n";
+      }
+
+      x += 1;
+      break;
+    }
+    case flags::g: {
+      const int idx = parse_option_value(argv[x], valid_gray_modes);
+      if (idx >= 0) {
+        gray_mode = imgr::GrayscaleMode(idx);
+      } else {
+        std::cerr << "Invalid grayscale mode! Using bt601 as default\n";
+      }
+
+      x += 1;
+      break;
+    }
+    case flags::s:
+      gray_output = imgr::GrayscaleOutput::gray;
+
+      x += 1;
+      break;
+    case flags::r: {
+      const std::string value = argv[x];
+      const std::string fields = value.substr(value.find('=') + 1);
+      if (std::sscanf(fields.c_str(), "%d,%d,%d,%d", &region[0], &region[1],
+                      &region[2], &region[3]) == 4 &&
+          region[0] >= 0 && region[1] >= 0 && region[2] > 0 &&
+          region[3] > 0) {
+        use_region = true;
+      } else {
+        std::cerr << "Invalid region! Filtering the whole image\n";
+      }
+
+      x += 1;
+      break;
+    }
     case flags::h:
       // TODO: Change order of help things, add mandatory -i
       std::cout << "usage: imagerio  [<option>] [<input>] ... [<option>] "
@@ -158,7 +357,24 @@ int main(int argc, char* argv[]) {
                    "./folder/image.png or "
                    "C:\\Users\\WindowsUser\\Pictures\\image.png \n"
                 << "\t-p or -parllel    set the program to use "
-                   "multi-threading \n\n";
+                   "multi-threading \n"
+                << "\t-m or -mode       gaussian blur engine: direct, "
+                   "separable, recursive, box, fixed, \n"
+                   "\t                  tiled, auto \n"
+                << "\t-b or -border     border mode: clamp, mirror, wrap, "
+                   "constant \n"
+                << "\t-k or -kuwahara   kuwahara engine: direct, sat, "
+                   "sliding, fused, pyramid \n"
+                << "\t-w or -window     kuwahara window size, odd, from 5 "
+                   "(default 7); \n"
+                   "\t                  anisotropic_kuwahara from 3 "
+                   "(default 13) \n"
+                << "\t-g or -gray       grayscale mode: bt601, bt709, average, "
+                   "max \n"
+                << "\t-s or -single     grayscale to a single-channel image "
+                   "\n"
+                << "\t-r or -region     filter only the rectangle x,y,w,h "
+                   "\n\n";
       earlyexit = true;
 
       break;
@@ -178,8 +394,19 @@ int main(int argc, char* argv[]) {
   // string
   imgr::Image og_img(inputfile);
 
+  // What the filter runs on: the whole image, or a region of it in place
+  imgr::ImageView target = og_img;
+  if (use_region) {
+    target = og_img.view(region[0], region[1], region[2], region[3]);
+    if (target.empty()) {
+      return -1;
+    }
+  }
+
 #ifdef DEBUG_PRINT
   og_img.print_stats();
+  std::cout << "SIMD level: "
+            << imgr::simd::isa_name(imgr::simd::isa_level()) << "\n";
   std::chrono::time_point start = std::chrono::high_resolution_clock::now();
 
   std::cout << "Filter: " << filter << "\n";
@@ -188,16 +415,46 @@ int main(int argc, char* argv[]) {
   // make decision based on filter
   switch (filter) {
   case filters_enum::gaussian_blur:
-    parallel_impl ? imgr::GaussianBlur::apply_gaussian_blur_parallel(og_img)
-                  : imgr::GaussianBlur::apply_gaussian_blur(og_img);
+    if (blur_engine == imgr::GaussianEngine::box) {
+      const auto error =
+          imgr::GaussianBlur::box_approximation_error(1.5f, 5);
+      std::cout << "Box approximation error: max " << error.max_abs
+                << " (" << error.relative * 100.0f << "% of peak), rms "
+                << error.rms << "\n";
+    }
+
+    parallel_impl ? imgr::GaussianBlur::apply_gaussian_blur_parallel(
+                        target, 1.5f, 5, blur_engine, border)
+                  : imgr::GaussianBlur::apply_gaussian_blur(
+                        target, 1.5f, 5, blur_engine, border);
     break;
   case filters_enum::grayscale:
-    parallel_impl ? imgr::GrayScale::grayscaleImageParallel(og_img)
-                  : imgr::GrayScale::grayscaleImage(og_img);
+    parallel_impl ? imgr::GrayScale::grayscaleImageParallel(target, gray_mode,
+                                                            gray_output)
+                  : imgr::GrayScale::grayscaleImage(target, gray_mode,
+                                                    gray_output);
     break;
-  case filters_enum::kuwahara:
-    imgr::KuwaharaFilter::apply_kuwara_filter(og_img);
+  case filters_enum::kuwahara: {
+    int window = kuwahara_window == 0 ? 7 : kuwahara_window;
+    if (window < 5) {
+      std::cerr << "Invalid kuwahara window! Using 7 as default\n";
+      window = 7;
+    }
+    parallel_impl ? imgr::KuwaharaFilter::apply_kuwara_filter_parallel(
+                        target, window, border, kuwahara_engine)
+                  : imgr::KuwaharaFilter::apply_kuwara_filter(
+                        target, window, border, kuwahara_engine);
+    break;
+  }
+  case filters_enum::anisotropic_kuwahara: {
+    const int window = kuwahara_window == 0 ? 13 : kuwahara_window;
+    parallel_impl
+        ? imgr::AnisotropicKuwahara::apply_anisotropic_kuwahara_parallel(
+              target, window, border)
+        : imgr::AnisotropicKuwahara::apply_anisotropic_kuwahara(
+              target, window, border);
     break;
+  }
   default: std::cerr << "Unhandeled filter!!!! \n"; break;
   }
 
@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef IMGR_PARALLEL_H
+#  define IMGR_PARALLEL_H
+
+#  include <omp.h>
+
+#  ifdef IMGR_USE_TBB
+#    include <tbb/blocked_range.h>
+#    include <tbb/parallel_for.h>
+#  endif
+
+namespace imgr {
+// Calls body(i) for every i in [begin, end), split across threads when
+// `parallel` is set. OpenMP by default; TBB when built with IMGR_USE_TBB, so
+// the filters can share a TBB thread pool with the host application. The
+// body must not depend on the order of calls.
+template <typename Body>
+inline void parallel_for_rows(int begin, int end, bool parallel, Body&& body) {
+#  ifdef IMGR_USE_TBB
+  if (parallel) {
+    tbb::parallel_for(tbb::blocked_range<int>(begin, end),
+                      [&](const tbb::blocked_range<int>& range) {
+                        for (int i = range.begin(); i < range.end(); ++i) {
+                          body(i);
+                        }
+                      });
+    return;
+  }
+  for (int i = begin; i < end; ++i) {
+    body(i);
+  }
+#  else
+#    pragma omp parallel for schedule(dynamic, 8) if (parallel)
+  for (int i = begin; i < end; ++i) {
+    body(i);
+  }
+#  endif
+}
+}  // namespace imgr
+
+#endif  // !IMGR_PARALLEL_H
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef IMGR_SIMD_ALIGNED_ALLOCATOR_H
+#  define IMGR_SIMD_ALIGNED_ALLOCATOR_H
+
+#  include <cstddef>
+#  include <new>
+#  include <vector>
+
+namespace imgr {
+namespace simd {
+
+// Cache line, and the widest vector register the kernels use
+constexpr std::size_t kSimdAlignment = 64;
+
+// std::allocator with a stronger alignment, so SIMD code can use aligned
+// loads on the first element
+template <typename T, std::size_t Alignment = kSimdAlignment>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() noexcept = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+  }
+
+  void deallocate(T* p, std::size_t) noexcept {
+    ::operator delete(p, std::align_val_t(Alignment));
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept {
+    return false;
+  }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// n elements of T rounded up to whole 64-byte lines. As the row stride of an
+// aligned 2D buffer it starts every row on a line, so vector loads at the
+// same column of different rows never straddle two.
+template <typename T>
+constexpr std::size_t padded_stride(std::size_t n) {
+  constexpr std::size_t per_line = kSimdAlignment / sizeof(T);
+  return (n + per_line - 1) / per_line * per_line;
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_ALIGNED_ALLOCATOR_H
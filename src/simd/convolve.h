@@ -0,0 +1,312 @@
+#pragma once
+
+#ifndef IMGR_SIMD_CONVOLVE_H
+#  define IMGR_SIMD_CONVOLVE_H
+
+#  include <algorithm>
+
+#  include "cpu_features.h"
+
+namespace imgr {
+namespace simd {
+
+// Float convolution kernels for one row of interleaved samples. Channels need
+// no special handling: with a padded source row, the tap k of every output
+// sample sits exactly k * channels floats further, so a whole row is a flat
+// run of independent lanes.
+//
+// Every tier sums the taps in the same order with separate multiplies and
+// adds (no FMA), so all of them produce bit-identical results.
+
+// dst[i] (+)= sum_k weights[k] * src[i + k * step], for i in [0, n)
+using ConvolveRowFn = void (*)(const float* src, float* dst, int n,
+                               const float* weights, int taps, int step,
+                               bool accumulate);
+
+// dst[i] = sum_k weights[k] * rows[k][i], for i in [0, n)
+using ConvolveColumnsFn = void (*)(const float* const* rows, float* dst, int n,
+                                   const float* weights, int taps);
+
+namespace detail {
+
+inline void convolve_row_scalar(const float* src, float* dst, int n,
+                                const float* weights, int taps, int step,
+                                bool accumulate) {
+  for (int i = 0; i < n; ++i) {
+    float acc = accumulate ? dst[i] : 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * src[i + k * step];
+    }
+    dst[i] = acc;
+  }
+}
+
+inline void convolve_columns_scalar(const float* const* rows, float* dst,
+                                    int n, const float* weights, int taps) {
+  for (int i = 0; i < n; ++i) {
+    float acc = 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * rows[k][i];
+    }
+    dst[i] = acc;
+  }
+}
+
+#  ifdef IMGR_SIMD_X86
+
+IMGR_TARGET_SSE41 inline void convolve_row_sse41(
+    const float* src, float* dst, int n, const float* weights, int taps,
+    int step, bool accumulate) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128 a0 = accumulate ? _mm_loadu_ps(dst + i) : _mm_setzero_ps();
+    __m128 a1 = accumulate ? _mm_loadu_ps(dst + i + 4) : _mm_setzero_ps();
+    __m128 a2 = accumulate ? _mm_loadu_ps(dst + i + 8) : _mm_setzero_ps();
+    __m128 a3 = accumulate ? _mm_loadu_ps(dst + i + 12) : _mm_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      const __m128 w = _mm_set1_ps(weights[k]);
+      a0 = _mm_add_ps(a0, _mm_mul_ps(w, _mm_loadu_ps(s)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(w, _mm_loadu_ps(s + 4)));
+      a2 = _mm_add_ps(a2, _mm_mul_ps(w, _mm_loadu_ps(s + 8)));
+      a3 = _mm_add_ps(a3, _mm_mul_ps(w, _mm_loadu_ps(s + 12)));
+    }
+    _mm_storeu_ps(dst + i, a0);
+    _mm_storeu_ps(dst + i + 4, a1);
+    _mm_storeu_ps(dst + i + 8, a2);
+    _mm_storeu_ps(dst + i + 12, a3);
+  }
+  for (; i + 4 <= n; i += 4) {
+    __m128 a = accumulate ? _mm_loadu_ps(dst + i) : _mm_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(s)));
+    }
+    _mm_storeu_ps(dst + i, a);
+  }
+  convolve_row_scalar(src + i, dst + i, n - i, weights, taps, step,
+                      accumulate);
+}
+
+IMGR_TARGET_SSE41 inline void convolve_columns_sse41(
+    const float* const* rows, float* dst, int n, const float* weights,
+    int taps) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128 a0 = _mm_setzero_ps();
+    __m128 a1 = _mm_setzero_ps();
+    __m128 a2 = _mm_setzero_ps();
+    __m128 a3 = _mm_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      const __m128 w = _mm_set1_ps(weights[k]);
+      const float* s = rows[k] + i;
+      a0 = _mm_add_ps(a0, _mm_mul_ps(w, _mm_loadu_ps(s)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(w, _mm_loadu_ps(s + 4)));
+      a2 = _mm_add_ps(a2, _mm_mul_ps(w, _mm_loadu_ps(s + 8)));
+      a3 = _mm_add_ps(a3, _mm_mul_ps(w, _mm_loadu_ps(s + 12)));
+    }
+    _mm_storeu_ps(dst + i, a0);
+    _mm_storeu_ps(dst + i + 4, a1);
+    _mm_storeu_ps(dst + i + 8, a2);
+    _mm_storeu_ps(dst + i + 12, a3);
+  }
+  for (; i + 4 <= n; i += 4) {
+    __m128 a = _mm_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      a = _mm_add_ps(
+          a, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+    }
+    _mm_storeu_ps(dst + i, a);
+  }
+  for (; i < n; ++i) {
+    float acc = 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * rows[k][i];
+    }
+    dst[i] = acc;
+  }
+}
+
+IMGR_TARGET_AVX2 inline void convolve_row_avx2(
+    const float* src, float* dst, int n, const float* weights, int taps,
+    int step, bool accumulate) {
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256 a0 = accumulate ? _mm256_loadu_ps(dst + i) : _mm256_setzero_ps();
+    __m256 a1 =
+        accumulate ? _mm256_loadu_ps(dst + i + 8) : _mm256_setzero_ps();
+    __m256 a2 =
+        accumulate ? _mm256_loadu_ps(dst + i + 16) : _mm256_setzero_ps();
+    __m256 a3 =
+        accumulate ? _mm256_loadu_ps(dst + i + 24) : _mm256_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      const __m256 w = _mm256_set1_ps(weights[k]);
+      a0 = _mm256_add_ps(a0, _mm256_mul_ps(w, _mm256_loadu_ps(s)));
+      a1 = _mm256_add_ps(a1, _mm256_mul_ps(w, _mm256_loadu_ps(s + 8)));
+      a2 = _mm256_add_ps(a2, _mm256_mul_ps(w, _mm256_loadu_ps(s + 16)));
+      a3 = _mm256_add_ps(a3, _mm256_mul_ps(w, _mm256_loadu_ps(s + 24)));
+    }
+    _mm256_storeu_ps(dst + i, a0);
+    _mm256_storeu_ps(dst + i + 8, a1);
+    _mm256_storeu_ps(dst + i + 16, a2);
+    _mm256_storeu_ps(dst + i + 24, a3);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m256 a = accumulate ? _mm256_loadu_ps(dst + i) : _mm256_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      a = _mm256_add_ps(
+          a, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(s)));
+    }
+    _mm256_storeu_ps(dst + i, a);
+  }
+  convolve_row_scalar(src + i, dst + i, n - i, weights, taps, step,
+                      accumulate);
+}
+
+IMGR_TARGET_AVX2 inline void convolve_columns_avx2(
+    const float* const* rows, float* dst, int n, const float* weights,
+    int taps) {
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256 a0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps();
+    __m256 a2 = _mm256_setzero_ps();
+    __m256 a3 = _mm256_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      const __m256 w = _mm256_set1_ps(weights[k]);
+      const float* s = rows[k] + i;
+      a0 = _mm256_add_ps(a0, _mm256_mul_ps(w, _mm256_loadu_ps(s)));
+      a1 = _mm256_add_ps(a1, _mm256_mul_ps(w, _mm256_loadu_ps(s + 8)));
+      a2 = _mm256_add_ps(a2, _mm256_mul_ps(w, _mm256_loadu_ps(s + 16)));
+      a3 = _mm256_add_ps(a3, _mm256_mul_ps(w, _mm256_loadu_ps(s + 24)));
+    }
+    _mm256_storeu_ps(dst + i, a0);
+    _mm256_storeu_ps(dst + i + 8, a1);
+    _mm256_storeu_ps(dst + i + 16, a2);
+    _mm256_storeu_ps(dst + i + 24, a3);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m256 a = _mm256_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_set1_ps(weights[k]),
+                                         _mm256_loadu_ps(rows[k] + i)));
+    }
+    _mm256_storeu_ps(dst + i, a);
+  }
+  for (; i < n; ++i) {
+    float acc = 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * rows[k][i];
+    }
+    dst[i] = acc;
+  }
+}
+
+IMGR_TARGET_AVX512 inline void convolve_row_avx512(
+    const float* src, float* dst, int n, const float* weights, int taps,
+    int step, bool accumulate) {
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m512 a0 = accumulate ? _mm512_loadu_ps(dst + i) : _mm512_setzero_ps();
+    __m512 a1 =
+        accumulate ? _mm512_loadu_ps(dst + i + 16) : _mm512_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      const __m512 w = _mm512_set1_ps(weights[k]);
+      a0 = _mm512_add_ps(a0, _mm512_mul_ps(w, _mm512_loadu_ps(s)));
+      a1 = _mm512_add_ps(a1, _mm512_mul_ps(w, _mm512_loadu_ps(s + 16)));
+    }
+    _mm512_storeu_ps(dst + i, a0);
+    _mm512_storeu_ps(dst + i + 16, a1);
+  }
+  // Masked tail instead of a scalar loop
+  for (; i < n; i += 16) {
+    const int rest = std::min(16, n - i);
+    const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+    __m512 a = accumulate ? _mm512_maskz_loadu_ps(mask, dst + i)
+                          : _mm512_setzero_ps();
+    const float* s = src + i;
+    for (int k = 0; k < taps; ++k, s += step) {
+      a = _mm512_add_ps(a, _mm512_mul_ps(_mm512_set1_ps(weights[k]),
+                                         _mm512_maskz_loadu_ps(mask, s)));
+    }
+    _mm512_mask_storeu_ps(dst + i, mask, a);
+  }
+}
+
+IMGR_TARGET_AVX512 inline void convolve_columns_avx512(
+    const float* const* rows, float* dst, int n, const float* weights,
+    int taps) {
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m512 a0 = _mm512_setzero_ps();
+    __m512 a1 = _mm512_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      const __m512 w = _mm512_set1_ps(weights[k]);
+      const float* s = rows[k] + i;
+      a0 = _mm512_add_ps(a0, _mm512_mul_ps(w, _mm512_loadu_ps(s)));
+      a1 = _mm512_add_ps(a1, _mm512_mul_ps(w, _mm512_loadu_ps(s + 16)));
+    }
+    _mm512_storeu_ps(dst + i, a0);
+    _mm512_storeu_ps(dst + i + 16, a1);
+  }
+  for (; i < n; i += 16) {
+    const int rest = std::min(16, n - i);
+    const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+    __m512 a = _mm512_setzero_ps();
+    for (int k = 0; k < taps; ++k) {
+      a = _mm512_add_ps(a, _mm512_mul_ps(_mm512_set1_ps(weights[k]),
+                                         _mm512_maskz_loadu_ps(mask,
+                                                               rows[k] + i)));
+    }
+    _mm512_mask_storeu_ps(dst + i, mask, a);
+  }
+}
+
+#  endif  // IMGR_SIMD_X86
+
+inline ConvolveRowFn select_convolve_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512: return convolve_row_avx512;
+  case IsaLevel::avx2:   return convolve_row_avx2;
+  case IsaLevel::sse41:  return convolve_row_sse41;
+  default:               break;
+  }
+#  endif
+  return convolve_row_scalar;
+}
+
+inline ConvolveColumnsFn select_convolve_columns() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512: return convolve_columns_avx512;
+  case IsaLevel::avx2:   return convolve_columns_avx2;
+  case IsaLevel::sse41:  return convolve_columns_sse41;
+  default:               break;
+  }
+#  endif
+  return convolve_columns_scalar;
+}
+
+}  // namespace detail
+
+inline void convolve_row(const float* src, float* dst, int n,
+                         const float* weights, int taps, int step,
+                         bool accumulate = false) {
+  static const ConvolveRowFn fn = detail::select_convolve_row();
+  fn(src, dst, n, weights, taps, step, accumulate);
+}
+
+inline void convolve_columns(const float* const* rows, float* dst, int n,
+                             const float* weights, int taps) {
+  static const ConvolveColumnsFn fn = detail::select_convolve_columns();
+  fn(rows, dst, n, weights, taps);
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_CONVOLVE_H
@@ -0,0 +1,338 @@
+#pragma once
+
+#ifndef IMGR_SIMD_CONVOLVE_FIXED_H
+#  define IMGR_SIMD_CONVOLVE_FIXED_H
+
+#  include <algorithm>
+#  include <cmath>
+#  include <cstdint>
+#  include <vector>
+
+#  include "cpu_features.h"
+
+namespace imgr {
+namespace simd {
+
+// Fixed-point counterpart of convolve.h for 8-bit images. Weights are Q14
+// (they sum to exactly 1 << 14), the intermediate between the two passes is
+// Q7 in int16 and all sums are int32:
+//   horizontal: 255 * 2^14       < 2^31, rounded down to Q7 (<= 32640)
+//   vertical:   32640 * 2^14     < 2^31, rounded down to 8 bits
+// Two taps share one multiply-add (pmaddwd), and int16 lanes are half the
+// width of float lanes, so each instruction covers twice the samples.
+//
+// Integer arithmetic is exact, so every tier gives identical results.
+
+constexpr int kFixedWeightBits = 14;
+constexpr int kFixedIntermediateBits = 7;
+
+// Rounds weights to Q14 and puts the rounding error on the largest weight,
+// so a flat area stays exactly flat
+inline std::vector<int16_t> quantize_weights(
+    const std::vector<float>& weights) {
+  std::vector<int16_t> quantized(weights.size());
+  int sum = 0;
+  size_t largest = 0;
+
+  for (size_t i = 0; i < weights.size(); ++i) {
+    quantized[i] = static_cast<int16_t>(
+        std::lround(weights[i] * (1 << kFixedWeightBits)));
+    sum += quantized[i];
+    if (weights[i] > weights[largest]) {
+      largest = i;
+    }
+  }
+
+  if (!quantized.empty()) {
+    quantized[largest] += (1 << kFixedWeightBits) - sum;
+  }
+
+  return quantized;
+}
+
+// dst[i] = round(sum_k weights[k] * src[i + k * step]) in Q7
+using ConvolveRowFixedFn = void (*)(const int16_t* src, int16_t* dst, int n,
+                                    const int16_t* weights, int taps,
+                                    int step);
+
+// dst[i] = clamp(round(sum_k weights[k] * rows[k][i]), 0, 255) in 8 bits,
+// for i in [begin, n)
+using ConvolveColumnsFixedFn = void (*)(const int16_t* const* rows,
+                                        uint8_t* dst, int n,
+                                        const int16_t* weights, int taps,
+                                        int begin);
+
+namespace detail {
+
+constexpr int kRowShift = kFixedWeightBits - kFixedIntermediateBits;
+constexpr int kColumnShift = kFixedWeightBits + kFixedIntermediateBits;
+
+inline void convolve_row_fixed_scalar(const int16_t* src, int16_t* dst, int n,
+                                      const int16_t* weights, int taps,
+                                      int step) {
+  for (int i = 0; i < n; ++i) {
+    int32_t acc = 0;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * src[i + k * step];
+    }
+    dst[i] = static_cast<int16_t>((acc + (1 << (kRowShift - 1))) >> kRowShift);
+  }
+}
+
+inline void convolve_columns_fixed_scalar(const int16_t* const* rows,
+                                          uint8_t* dst, int n,
+                                          const int16_t* weights, int taps,
+                                          int begin) {
+  for (int i = begin; i < n; ++i) {
+    int32_t acc = 0;
+    for (int k = 0; k < taps; ++k) {
+      acc += weights[k] * rows[k][i];
+    }
+    acc = (acc + (1 << (kColumnShift - 1))) >> kColumnShift;
+    dst[i] = static_cast<uint8_t>(std::min(255, std::max(0, acc)));
+  }
+}
+
+// Two neighbouring weights packed into the 32-bit lane layout pmaddwd wants
+inline int32_t weight_pair(const int16_t* weights, int taps, int k) {
+  const uint16_t low = static_cast<uint16_t>(weights[k]);
+  const uint16_t high =
+      k + 1 < taps ? static_cast<uint16_t>(weights[k + 1]) : uint16_t{0};
+  return static_cast<int32_t>(low | (static_cast<uint32_t>(high) << 16));
+}
+
+#  ifdef IMGR_SIMD_X86
+
+IMGR_TARGET_SSE41 inline void convolve_row_fixed_sse41(
+    const int16_t* src, int16_t* dst, int n, const int16_t* weights, int taps,
+    int step) {
+  const __m128i round = _mm_set1_epi32(1 << (kRowShift - 1));
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (int k = 0; k < taps; k += 2) {
+      const __m128i w = _mm_set1_epi32(weight_pair(weights, taps, k));
+      const __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(src + i + k * step));
+      // Odd tap count: the last pair has a zero weight, any data will do
+      const __m128i b =
+          k + 1 < taps ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                             src + i + (k + 1) * step))
+                       : a;
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+    }
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), kRowShift);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), kRowShift);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packs_epi32(lo, hi));
+  }
+  convolve_row_fixed_scalar(src + i, dst + i, n - i, weights, taps, step);
+}
+
+IMGR_TARGET_SSE41 inline void convolve_columns_fixed_sse41(
+    const int16_t* const* rows, uint8_t* dst, int n, const int16_t* weights,
+    int taps, int begin) {
+  const __m128i round = _mm_set1_epi32(1 << (kColumnShift - 1));
+  int i = begin;
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (int k = 0; k < taps; k += 2) {
+      const __m128i w = _mm_set1_epi32(weight_pair(weights, taps, k));
+      const __m128i a =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+      const __m128i b = k + 1 < taps
+                            ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                                  rows[k + 1] + i))
+                            : a;
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+    }
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), kColumnShift);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), kColumnShift);
+    const __m128i words = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(words, words));
+  }
+  convolve_columns_fixed_scalar(rows, dst, n, weights, taps, i);
+}
+
+IMGR_TARGET_AVX2 inline void convolve_row_fixed_avx2(const int16_t* src,
+                                                    int16_t* dst, int n,
+                                                    const int16_t* weights,
+                                                    int taps, int step) {
+  const __m256i round = _mm256_set1_epi32(1 << (kRowShift - 1));
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    for (int k = 0; k < taps; k += 2) {
+      const __m256i w = _mm256_set1_epi32(weight_pair(weights, taps, k));
+      const __m256i a = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(src + i + k * step));
+      const __m256i b =
+          k + 1 < taps ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                             src + i + (k + 1) * step))
+                       : a;
+      lo = _mm256_add_epi32(lo,
+                            _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+      hi = _mm256_add_epi32(hi,
+                            _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+    }
+    // unpack and pack both work per 128-bit lane, so their shuffles cancel
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), kRowShift);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), kRowShift);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_packs_epi32(lo, hi));
+  }
+  convolve_row_fixed_scalar(src + i, dst + i, n - i, weights, taps, step);
+}
+
+IMGR_TARGET_AVX2 inline __m256i convolve_columns_fixed_avx2_block(
+    const int16_t* const* rows, int i, const int16_t* weights, int taps) {
+  const __m256i round = _mm256_set1_epi32(1 << (kColumnShift - 1));
+  __m256i lo = _mm256_setzero_si256();
+  __m256i hi = _mm256_setzero_si256();
+  for (int k = 0; k < taps; k += 2) {
+    const __m256i w = _mm256_set1_epi32(weight_pair(weights, taps, k));
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + i));
+    const __m256i b =
+        k + 1 < taps ? _mm256_loadu_si256(
+                           reinterpret_cast<const __m256i*>(rows[k + 1] + i))
+                     : a;
+    lo = _mm256_add_epi32(lo,
+                          _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+    hi = _mm256_add_epi32(hi,
+                          _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+  }
+  lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), kColumnShift);
+  hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), kColumnShift);
+  return _mm256_packs_epi32(lo, hi);
+}
+
+IMGR_TARGET_AVX2 inline void convolve_columns_fixed_avx2(
+    const int16_t* const* rows, uint8_t* dst, int n, const int16_t* weights,
+    int taps, int begin) {
+  int i = begin;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i first =
+        convolve_columns_fixed_avx2_block(rows, i, weights, taps);
+    const __m256i second =
+        convolve_columns_fixed_avx2_block(rows, i + 16, weights, taps);
+    // packus interleaves the 128-bit lanes of its inputs, put them back
+    const __m256i bytes = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), bytes);
+  }
+  convolve_columns_fixed_sse41(rows, dst, n, weights, taps, i);
+}
+
+IMGR_TARGET_AVX512 inline void convolve_row_fixed_avx512(
+    const int16_t* src, int16_t* dst, int n, const int16_t* weights, int taps,
+    int step) {
+  const __m512i round = _mm512_set1_epi32(1 << (kRowShift - 1));
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m512i lo = _mm512_setzero_si512();
+    __m512i hi = _mm512_setzero_si512();
+    for (int k = 0; k < taps; k += 2) {
+      const __m512i w = _mm512_set1_epi32(weight_pair(weights, taps, k));
+      const __m512i a = _mm512_loadu_si512(src + i + k * step);
+      const __m512i b =
+          k + 1 < taps ? _mm512_loadu_si512(src + i + (k + 1) * step) : a;
+      lo = _mm512_add_epi32(lo,
+                            _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+      hi = _mm512_add_epi32(hi,
+                            _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+    }
+    lo = _mm512_srai_epi32(_mm512_add_epi32(lo, round), kRowShift);
+    hi = _mm512_srai_epi32(_mm512_add_epi32(hi, round), kRowShift);
+    _mm512_storeu_si512(dst + i, _mm512_packs_epi32(lo, hi));
+  }
+  convolve_row_fixed_avx2(src + i, dst + i, n - i, weights, taps, step);
+}
+
+IMGR_TARGET_AVX512 inline __m512i convolve_columns_fixed_avx512_block(
+    const int16_t* const* rows, int i, const int16_t* weights, int taps) {
+  const __m512i round = _mm512_set1_epi32(1 << (kColumnShift - 1));
+  __m512i lo = _mm512_setzero_si512();
+  __m512i hi = _mm512_setzero_si512();
+  for (int k = 0; k < taps; k += 2) {
+    const __m512i w = _mm512_set1_epi32(weight_pair(weights, taps, k));
+    const __m512i a = _mm512_loadu_si512(rows[k] + i);
+    const __m512i b = k + 1 < taps ? _mm512_loadu_si512(rows[k + 1] + i) : a;
+    lo = _mm512_add_epi32(lo,
+                          _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+    hi = _mm512_add_epi32(hi,
+                          _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+  }
+  lo = _mm512_srai_epi32(_mm512_add_epi32(lo, round), kColumnShift);
+  hi = _mm512_srai_epi32(_mm512_add_epi32(hi, round), kColumnShift);
+  return _mm512_packs_epi32(lo, hi);
+}
+
+IMGR_TARGET_AVX512 inline void convolve_columns_fixed_avx512(
+    const int16_t* const* rows, uint8_t* dst, int n, const int16_t* weights,
+    int taps, int begin) {
+  const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+  int i = begin;
+  for (; i + 64 <= n; i += 64) {
+    const __m512i first =
+        convolve_columns_fixed_avx512_block(rows, i, weights, taps);
+    const __m512i second =
+        convolve_columns_fixed_avx512_block(rows, i + 32, weights, taps);
+    const __m512i bytes = _mm512_permutexvar_epi64(
+        order, _mm512_packus_epi16(first, second));
+    _mm512_storeu_si512(dst + i, bytes);
+  }
+  convolve_columns_fixed_avx2(rows, dst, n, weights, taps, i);
+}
+
+#  endif  // IMGR_SIMD_X86
+
+inline ConvolveRowFixedFn select_convolve_row_fixed() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512: return convolve_row_fixed_avx512;
+  case IsaLevel::avx2:   return convolve_row_fixed_avx2;
+  case IsaLevel::sse41:  return convolve_row_fixed_sse41;
+  default:               break;
+  }
+#  endif
+  return convolve_row_fixed_scalar;
+}
+
+inline ConvolveColumnsFixedFn select_convolve_columns_fixed() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512: return convolve_columns_fixed_avx512;
+  case IsaLevel::avx2:   return convolve_columns_fixed_avx2;
+  case IsaLevel::sse41:  return convolve_columns_fixed_sse41;
+  default:               break;
+  }
+#  endif
+  return convolve_columns_fixed_scalar;
+}
+
+}  // namespace detail
+
+inline void convolve_row_fixed(const int16_t* src, int16_t* dst, int n,
+                               const int16_t* weights, int taps, int step) {
+  static const ConvolveRowFixedFn fn = detail::select_convolve_row_fixed();
+  fn(src, dst, n, weights, taps, step);
+}
+
+inline void convolve_columns_fixed(const int16_t* const* rows, uint8_t* dst,
+                                   int n, const int16_t* weights, int taps) {
+  static const ConvolveColumnsFixedFn fn =
+      detail::select_convolve_columns_fixed();
+  fn(rows, dst, n, weights, taps, 0);
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_CONVOLVE_FIXED_H
@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef IMGR_SIMD_CPU_FEATURES_H
+#  define IMGR_SIMD_CPU_FEATURES_H
+
+#  include <cstdlib>
+#  include <cstring>
+
+#  if defined(__unix__) || defined(__APPLE__)
+#    include <unistd.h>
+#  endif
+
+#  if (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__GNUC__) || defined(__clang__))
+#    define IMGR_SIMD_X86 1
+#    include <immintrin.h>
+
+// Per-function targets, so one binary carries every tier. Kernels keep
+// multiplies and adds separate to stay bit-identical across tiers, but
+// AVX-512F implies FMA and GCC would fuse them, hence fp-contract=off.
+#    ifdef __clang__
+#      define IMGR_TARGET_SSE41 __attribute__((target("sse4.1")))
+#      define IMGR_TARGET_AVX2 __attribute__((target("avx2")))
+#      define IMGR_TARGET_AVX512 \
+        __attribute__((target("avx512f,avx512bw")))
+#    else
+#      define IMGR_TARGET_SSE41 \
+        __attribute__((target("sse4.1"), optimize("fp-contract=off")))
+#      define IMGR_TARGET_AVX2 \
+        __attribute__((target("avx2"), optimize("fp-contract=off")))
+#      define IMGR_TARGET_AVX512                 \
+        __attribute__((target("avx512f,avx512bw"), \
+                       optimize("fp-contract=off")))
+#    endif
+#  endif
+
+namespace imgr {
+namespace simd {
+
+// Instruction set tiers the kernels are compiled for. Each tier implies the
+// ones below it.
+enum class IsaLevel {
+  scalar = 0,
+  sse41,
+  avx2,
+  avx512,  // AVX-512 F + BW
+};
+
+inline const char* isa_name(IsaLevel level) {
+  switch (level) {
+  case IsaLevel::sse41:  return "sse4.1";
+  case IsaLevel::avx2:   return "avx2";
+  case IsaLevel::avx512: return "avx512";
+  case IsaLevel::scalar:
+  default:               return "scalar";
+  }
+}
+
+inline IsaLevel detect_isa_level() {
+  IsaLevel level = IsaLevel::scalar;
+
+#  ifdef IMGR_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    level = IsaLevel::avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    level = IsaLevel::avx2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    level = IsaLevel::sse41;
+  }
+#  endif
+
+  // IMGR_SIMD=scalar|sse4.1|avx2|avx512 caps the level, e.g. to compare
+  // outputs between tiers on one machine
+  if (const char* cap = std::getenv("IMGR_SIMD")) {
+    for (IsaLevel candidate : {IsaLevel::scalar, IsaLevel::sse41,
+                               IsaLevel::avx2, IsaLevel::avx512}) {
+      if (std::strcmp(cap, isa_name(candidate)) == 0 && candidate < level) {
+        level = candidate;
+      }
+    }
+  }
+
+  return level;
+}
+
+// Detected once per process; every dispatcher reads it from here
+inline IsaLevel isa_level() {
+  static const IsaLevel level = detect_isa_level();
+  return level;
+}
+
+// Per-core L2 size in bytes, for sizing tiles. 1 MiB when the OS does not
+// say.
+inline long l2_cache_size() {
+  static const long size = [] {
+    long bytes = 0;
+#  ifdef _SC_LEVEL2_CACHE_SIZE
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#  endif
+    return bytes > 0 ? bytes : 1L << 20;
+  }();
+  return size;
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_CPU_FEATURES_H
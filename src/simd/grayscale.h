@@ -0,0 +1,439 @@
+#pragma once
+
+#ifndef IMGR_SIMD_GRAYSCALE_H
+#  define IMGR_SIMD_GRAYSCALE_H
+
+#  include <algorithm>
+#  include <cstdint>
+
+#  include "cpu_features.h"
+#  include "interleave.h"
+
+namespace imgr {
+namespace simd {
+
+// How the three colour channels become one: Q15 weights of R, G and B that
+// sum to exactly 1 << 15, or the largest of the three when `maximum` is set.
+// Weighted gray is (r * wr + g * wg + b * wb + 2^14) >> 15; the largest sum
+// is 255 * 2^15 + 2^14 < 2^31, so int32 is exact and every tier gives
+// identical results.
+struct GrayMix {
+  int16_t r;
+  int16_t g;
+  int16_t b;
+  bool maximum;
+};
+
+constexpr int kGrayWeightBits = 15;
+
+// Converts n interleaved RGB (channels = 3) or RGBA (4) pixels from src to
+// dst. With dst_channels equal to channels gray goes into R, G and B and
+// alpha is copied, and dst may be src. With dst_channels = channels - 2 the
+// output is compact: one gray byte per pixel, or gray then alpha.
+using GrayscaleRowFn = void (*)(const uint8_t* src, uint8_t* dst, int n,
+                                int channels, int dst_channels,
+                                const GrayMix& mix);
+
+// Gray of n pixels given as R, G and B planes, written to `gray`, which may
+// be the R plane. Planes need no shuffles, only the weighted sum.
+using GrayscalePlanesFn = void (*)(const uint8_t* r, const uint8_t* g,
+                                   const uint8_t* b, uint8_t* gray, int n,
+                                   const GrayMix& mix);
+
+namespace detail {
+
+inline uint8_t gray_pixel(const uint8_t* pixel, const GrayMix& mix) {
+  if (mix.maximum) {
+    return std::max(pixel[0], std::max(pixel[1], pixel[2]));
+  }
+  const int32_t sum = pixel[0] * mix.r + pixel[1] * mix.g + pixel[2] * mix.b +
+                      (1 << (kGrayWeightBits - 1));
+  return static_cast<uint8_t>(sum >> kGrayWeightBits);
+}
+
+inline void grayscale_row_scalar(const uint8_t* src, uint8_t* dst, int n,
+                                 int channels, int dst_channels,
+                                 const GrayMix& mix) {
+  const bool compact = dst_channels < channels;
+  for (int i = 0; i < n; ++i) {
+    const uint8_t* pixel = src + i * channels;
+    uint8_t* out = dst + i * dst_channels;
+    const uint8_t gray = gray_pixel(pixel, mix);
+    if (compact) {
+      if (channels == 4) {
+        out[1] = pixel[3];
+      }
+      out[0] = gray;
+      continue;
+    }
+    if (channels == 4) {
+      out[3] = pixel[3];
+    }
+    out[0] = gray;
+    out[1] = gray;
+    out[2] = gray;
+  }
+}
+
+// Pixels are gathered into planes with the masks from interleave.h. Going
+// back, each byte of an output block takes gray[j] for the colour bytes of
+// pixel j, and 0 for alpha, which is merged in separately.
+constexpr ShuffleMask scatter_mask(int channels, int block) {
+  ShuffleMask mask{};
+  for (int k = 0; k < 16; ++k) {
+    const int at = 16 * block + k;
+    mask[k] = static_cast<int8_t>(at % channels < 3 ? at / channels : -128);
+  }
+  return mask;
+}
+
+// Masks for every block, indexed [block][channel] and [block]; RGB only uses
+// the first three blocks. The alpha gathers are for compact gray+alpha output.
+struct GrayShuffles {
+  ShuffleMask gather[4][4];
+  ShuffleMask scatter[4];
+};
+
+constexpr GrayShuffles make_gray_shuffles(int channels) {
+  GrayShuffles shuffles{};
+  for (int block = 0; block < channels; ++block) {
+    for (int c = 0; c < channels; ++c) {
+      shuffles.gather[block][c] = gather_mask(channels, c, block);
+    }
+    shuffles.scatter[block] = scatter_mask(channels, block);
+  }
+  return shuffles;
+}
+
+constexpr GrayShuffles kRgbGrayShuffles = make_gray_shuffles(3);
+constexpr GrayShuffles kRgbaGrayShuffles = make_gray_shuffles(4);
+
+inline void grayscale_planes_scalar(const uint8_t* r, const uint8_t* g,
+                                    const uint8_t* b, uint8_t* gray, int n,
+                                    const GrayMix& mix) {
+  for (int i = 0; i < n; ++i) {
+    const uint8_t pixel[3] = {r[i], g[i], b[i]};
+    gray[i] = gray_pixel(pixel, mix);
+  }
+}
+
+#  ifdef IMGR_SIMD_X86
+
+// Weighted gray of 8 pixels whose channels are widened to int16. B is paired
+// with the rounding constant and weight 1, so two pmaddwd give the whole sum.
+IMGR_TARGET_SSE41 inline __m128i weighted_sse41(__m128i r, __m128i g,
+                                                __m128i b, __m128i rg_weights,
+                                                __m128i b_weights) {
+  const __m128i round = _mm_set1_epi16(1 << (kGrayWeightBits - 1));
+  const __m128i lo = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpacklo_epi16(r, g), rg_weights),
+      _mm_madd_epi16(_mm_unpacklo_epi16(b, round), b_weights));
+  const __m128i hi = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpackhi_epi16(r, g), rg_weights),
+      _mm_madd_epi16(_mm_unpackhi_epi16(b, round), b_weights));
+  return _mm_packs_epi32(_mm_srai_epi32(lo, kGrayWeightBits),
+                         _mm_srai_epi32(hi, kGrayWeightBits));
+}
+
+IMGR_TARGET_SSE41 inline void grayscale_row_sse41(const uint8_t* src,
+                                                  uint8_t* dst, int n,
+                                                  int channels,
+                                                  int dst_channels,
+                                                  const GrayMix& mix) {
+  const GrayShuffles& shuffles =
+      channels == 4 ? kRgbaGrayShuffles : kRgbGrayShuffles;
+  const bool compact = dst_channels < channels;
+  // Compact gray+alpha also needs alpha as a plane
+  const int num_planes = compact && channels == 4 ? 4 : 3;
+  const __m128i rg_weights = _mm_set1_epi32(
+      static_cast<uint16_t>(mix.r) | (static_cast<uint32_t>(mix.g) << 16));
+  const __m128i b_weights =
+      _mm_set1_epi32(static_cast<uint16_t>(mix.b) | (1u << 16));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const uint8_t* in = src + i * channels;
+    uint8_t* out = dst + i * dst_channels;
+
+    __m128i blocks[4];
+    __m128i planes[4] = {zero, zero, zero, zero};
+    for (int block = 0; block < channels; ++block) {
+      blocks[block] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(in + 16 * block));
+      for (int c = 0; c < num_planes; ++c) {
+        planes[c] = _mm_or_si128(
+            planes[c],
+            _mm_shuffle_epi8(blocks[block],
+                             load_mask_sse41(shuffles.gather[block][c])));
+      }
+    }
+
+    __m128i gray;
+    if (mix.maximum) {
+      gray = _mm_max_epu8(_mm_max_epu8(planes[0], planes[1]), planes[2]);
+    } else {
+      const __m128i lo = weighted_sse41(
+          _mm_cvtepu8_epi16(planes[0]), _mm_cvtepu8_epi16(planes[1]),
+          _mm_cvtepu8_epi16(planes[2]), rg_weights, b_weights);
+      const __m128i hi = weighted_sse41(
+          _mm_unpackhi_epi8(planes[0], zero),
+          _mm_unpackhi_epi8(planes[1], zero),
+          _mm_unpackhi_epi8(planes[2], zero), rg_weights, b_weights);
+      gray = _mm_packus_epi16(lo, hi);
+    }
+
+    if (compact) {
+      if (channels == 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                         _mm_unpacklo_epi8(gray, planes[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+                         _mm_unpackhi_epi8(gray, planes[3]));
+      } else {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), gray);
+      }
+      continue;
+    }
+
+    for (int block = 0; block < channels; ++block) {
+      __m128i result =
+          _mm_shuffle_epi8(gray, load_mask_sse41(shuffles.scatter[block]));
+      if (channels == 4) {
+        result = _mm_or_si128(result, _mm_and_si128(blocks[block], alpha));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block), result);
+    }
+  }
+  grayscale_row_scalar(src + i * channels, dst + i * dst_channels, n - i,
+                       channels, dst_channels, mix);
+}
+
+// Two groups of 16 pixels per iteration, one per 128-bit lane. pshufb works
+// within lanes, so the SSE masks apply unchanged to each group.
+IMGR_TARGET_AVX2 inline __m256i weighted_avx2(__m256i r, __m256i g, __m256i b,
+                                              __m256i rg_weights,
+                                              __m256i b_weights) {
+  const __m256i round = _mm256_set1_epi16(1 << (kGrayWeightBits - 1));
+  const __m256i lo = _mm256_add_epi32(
+      _mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), rg_weights),
+      _mm256_madd_epi16(_mm256_unpacklo_epi16(b, round), b_weights));
+  const __m256i hi = _mm256_add_epi32(
+      _mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), rg_weights),
+      _mm256_madd_epi16(_mm256_unpackhi_epi16(b, round), b_weights));
+  return _mm256_packs_epi32(_mm256_srai_epi32(lo, kGrayWeightBits),
+                            _mm256_srai_epi32(hi, kGrayWeightBits));
+}
+
+IMGR_TARGET_AVX2 inline void grayscale_row_avx2(const uint8_t* src,
+                                                uint8_t* dst, int n,
+                                                int channels, int dst_channels,
+                                                const GrayMix& mix) {
+  const GrayShuffles& shuffles =
+      channels == 4 ? kRgbaGrayShuffles : kRgbGrayShuffles;
+  const bool compact = dst_channels < channels;
+  const int num_planes = compact && channels == 4 ? 4 : 3;
+  const __m256i rg_weights = _mm256_set1_epi32(
+      static_cast<uint16_t>(mix.r) | (static_cast<uint32_t>(mix.g) << 16));
+  const __m256i b_weights =
+      _mm256_set1_epi32(static_cast<uint16_t>(mix.b) | (1u << 16));
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+  // Byte offset of the second group
+  const int second = 16 * channels;
+
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const uint8_t* in = src + i * channels;
+    uint8_t* out = dst + i * dst_channels;
+
+    __m256i blocks[4];
+    __m256i planes[4] = {zero, zero, zero, zero};
+    for (int block = 0; block < channels; ++block) {
+      blocks[block] = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + 16 * block))),
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + second + 16 * block)),
+          1);
+      for (int c = 0; c < num_planes; ++c) {
+        planes[c] = _mm256_or_si256(
+            planes[c],
+            _mm256_shuffle_epi8(blocks[block],
+                                load_mask_avx2(shuffles.gather[block][c])));
+      }
+    }
+
+    __m256i gray;
+    if (mix.maximum) {
+      gray =
+          _mm256_max_epu8(_mm256_max_epu8(planes[0], planes[1]), planes[2]);
+    } else {
+      const __m256i lo = weighted_avx2(
+          _mm256_unpacklo_epi8(planes[0], zero),
+          _mm256_unpacklo_epi8(planes[1], zero),
+          _mm256_unpacklo_epi8(planes[2], zero), rg_weights, b_weights);
+      const __m256i hi = weighted_avx2(
+          _mm256_unpackhi_epi8(planes[0], zero),
+          _mm256_unpackhi_epi8(planes[1], zero),
+          _mm256_unpackhi_epi8(planes[2], zero), rg_weights, b_weights);
+      gray = _mm256_packus_epi16(lo, hi);
+    }
+
+    // Lane k holds pixels 16k to 16k + 15, so a compact gray row is stored
+    // as it is; gray+alpha interleaves within lanes and is put back in order
+    if (compact) {
+      if (channels == 4) {
+        const __m256i lo = _mm256_unpacklo_epi8(gray, planes[3]);
+        const __m256i hi = _mm256_unpackhi_epi8(gray, planes[3]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+      } else {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), gray);
+      }
+      continue;
+    }
+
+    for (int block = 0; block < channels; ++block) {
+      __m256i result = _mm256_shuffle_epi8(
+          gray, load_mask_avx2(shuffles.scatter[block]));
+      if (channels == 4) {
+        result =
+            _mm256_or_si256(result, _mm256_and_si256(blocks[block], alpha));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block),
+                       _mm256_castsi256_si128(result));
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(out + second + 16 * block),
+          _mm256_extracti128_si256(result, 1));
+    }
+  }
+  grayscale_row_sse41(src + i * channels, dst + i * dst_channels, n - i,
+                      channels, dst_channels, mix);
+}
+
+IMGR_TARGET_SSE41 inline void grayscale_planes_sse41(const uint8_t* r,
+                                                     const uint8_t* g,
+                                                     const uint8_t* b,
+                                                     uint8_t* gray, int n,
+                                                     const GrayMix& mix) {
+  const __m128i rg_weights = _mm_set1_epi32(
+      static_cast<uint16_t>(mix.r) | (static_cast<uint32_t>(mix.g) << 16));
+  const __m128i b_weights =
+      _mm_set1_epi32(static_cast<uint16_t>(mix.b) | (1u << 16));
+  const __m128i zero = _mm_setzero_si128();
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i red =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+    const __m128i green =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+    const __m128i blue =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+
+    __m128i result;
+    if (mix.maximum) {
+      result = _mm_max_epu8(_mm_max_epu8(red, green), blue);
+    } else {
+      const __m128i lo = weighted_sse41(
+          _mm_cvtepu8_epi16(red), _mm_cvtepu8_epi16(green),
+          _mm_cvtepu8_epi16(blue), rg_weights, b_weights);
+      const __m128i hi = weighted_sse41(
+          _mm_unpackhi_epi8(red, zero), _mm_unpackhi_epi8(green, zero),
+          _mm_unpackhi_epi8(blue, zero), rg_weights, b_weights);
+      result = _mm_packus_epi16(lo, hi);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(gray + i), result);
+  }
+  grayscale_planes_scalar(r + i, g + i, b + i, gray + i, n - i, mix);
+}
+
+IMGR_TARGET_AVX2 inline void grayscale_planes_avx2(const uint8_t* r,
+                                                   const uint8_t* g,
+                                                   const uint8_t* b,
+                                                   uint8_t* gray, int n,
+                                                   const GrayMix& mix) {
+  const __m256i rg_weights = _mm256_set1_epi32(
+      static_cast<uint16_t>(mix.r) | (static_cast<uint32_t>(mix.g) << 16));
+  const __m256i b_weights =
+      _mm256_set1_epi32(static_cast<uint16_t>(mix.b) | (1u << 16));
+  const __m256i zero = _mm256_setzero_si256();
+
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i red =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+    const __m256i green =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + i));
+    const __m256i blue =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+
+    // Unpacking and packing both stay within lanes, so pixels keep their
+    // order
+    __m256i result;
+    if (mix.maximum) {
+      result = _mm256_max_epu8(_mm256_max_epu8(red, green), blue);
+    } else {
+      const __m256i lo = weighted_avx2(
+          _mm256_unpacklo_epi8(red, zero), _mm256_unpacklo_epi8(green, zero),
+          _mm256_unpacklo_epi8(blue, zero), rg_weights, b_weights);
+      const __m256i hi = weighted_avx2(
+          _mm256_unpackhi_epi8(red, zero), _mm256_unpackhi_epi8(green, zero),
+          _mm256_unpackhi_epi8(blue, zero), rg_weights, b_weights);
+      result = _mm256_packus_epi16(lo, hi);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(gray + i), result);
+  }
+  grayscale_planes_sse41(r + i, g + i, b + i, gray + i, n - i, mix);
+}
+
+#  endif  // IMGR_SIMD_X86
+
+// AVX-512 shuffles bytes within 128-bit lanes too, and at 3-4 loads per 16
+// pixels the conversion is already bound by memory, so that tier runs AVX2
+inline GrayscaleRowFn select_grayscale_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return grayscale_row_avx2;
+  case IsaLevel::sse41:  return grayscale_row_sse41;
+  default:               break;
+  }
+#  endif
+  return grayscale_row_scalar;
+}
+
+inline GrayscalePlanesFn select_grayscale_planes() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return grayscale_planes_avx2;
+  case IsaLevel::sse41:  return grayscale_planes_sse41;
+  default:               break;
+  }
+#  endif
+  return grayscale_planes_scalar;
+}
+
+}  // namespace detail
+
+inline void grayscale_planes(const uint8_t* r, const uint8_t* g,
+                             const uint8_t* b, uint8_t* gray, int n,
+                             const GrayMix& mix) {
+  static const GrayscalePlanesFn fn = detail::select_grayscale_planes();
+  fn(r, g, b, gray, n, mix);
+}
+
+inline void grayscale_row(const uint8_t* src, uint8_t* dst, int n,
+                          int channels, int dst_channels, const GrayMix& mix) {
+  static const GrayscaleRowFn fn = detail::select_grayscale_row();
+  fn(src, dst, n, channels, dst_channels, mix);
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_GRAYSCALE_H
@@ -0,0 +1,260 @@
+#pragma once
+
+#ifndef IMGR_SIMD_HSV_H
+#  define IMGR_SIMD_HSV_H
+
+#  include <algorithm>
+#  include <cstdint>
+
+#  include "cpu_features.h"
+
+namespace imgr {
+namespace simd {
+
+// Converts n pixels in place from R, G and B planes in [0, 1] to hue in
+// degrees [0, 360), saturation and value in [0, 1]
+using RgbToHsvFn = void (*)(float* const* planes, int n);
+
+// The other way round. Hue may be anywhere in [0, 360]; saturation and value
+// are used as they are, so out of range values give out of range RGB.
+using HsvToRgbFn = void (*)(float* const* planes, int n);
+
+namespace detail {
+
+// Every tier runs the same float operations in the same order, without
+// fused multiply-adds, so all of them give bit-identical planes
+
+inline void rgb_to_hsv_scalar(float* const* planes, int n) {
+  for (int i = 0; i < n; ++i) {
+    const float r = planes[0][i];
+    const float g = planes[1][i];
+    const float b = planes[2][i];
+    const float max = std::max(r, std::max(g, b));
+    const float min = std::min(r, std::min(g, b));
+    const float delta = max - min;
+
+    // Sextant of the hue circle from the largest channel, R winning ties
+    float numerator = r - g;
+    float offset = 4.0f;
+    if (max == r) {
+      numerator = g - b;
+      offset = 0.0f;
+    } else if (max == g) {
+      numerator = b - r;
+      offset = 2.0f;
+    }
+
+    float hue = delta > 0.0f ? offset + numerator / delta : 0.0f;
+    hue = hue < 0.0f ? hue + 6.0f : hue;
+
+    planes[0][i] = hue * 60.0f;
+    planes[1][i] = max > 0.0f ? delta / max : 0.0f;
+    planes[2][i] = max;
+  }
+}
+
+// Channel n in {5, 3, 1} for R, G, B is v - v * s * clamp(min(k, 4 - k)),
+// k = (n + hue / 60) mod 6: no branches on the sextant
+inline float hsv_channel(float sextant, float chroma, float value, float n) {
+  float k = n + sextant;
+  k = k >= 6.0f ? k - 6.0f : k;
+  const float weight = std::min(std::max(std::min(k, 4.0f - k), 0.0f), 1.0f);
+  return value - chroma * weight;
+}
+
+inline void hsv_to_rgb_scalar(float* const* planes, int n) {
+  for (int i = 0; i < n; ++i) {
+    const float sextant = planes[0][i] * (1.0f / 60.0f);
+    const float value = planes[2][i];
+    const float chroma = value * planes[1][i];
+
+    planes[0][i] = hsv_channel(sextant, chroma, value, 5.0f);
+    planes[1][i] = hsv_channel(sextant, chroma, value, 3.0f);
+    planes[2][i] = hsv_channel(sextant, chroma, value, 1.0f);
+  }
+}
+
+#  ifdef IMGR_SIMD_X86
+
+IMGR_TARGET_SSE41 inline void rgb_to_hsv_sse41(float* const* planes, int n) {
+  const __m128 zero = _mm_setzero_ps();
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 r = _mm_loadu_ps(planes[0] + i);
+    const __m128 g = _mm_loadu_ps(planes[1] + i);
+    const __m128 b = _mm_loadu_ps(planes[2] + i);
+    const __m128 max = _mm_max_ps(r, _mm_max_ps(g, b));
+    const __m128 min = _mm_min_ps(r, _mm_min_ps(g, b));
+    const __m128 delta = _mm_sub_ps(max, min);
+
+    const __m128 is_r = _mm_cmpeq_ps(max, r);
+    const __m128 is_g = _mm_andnot_ps(is_r, _mm_cmpeq_ps(max, g));
+    __m128 numerator = _mm_blendv_ps(_mm_sub_ps(r, g), _mm_sub_ps(b, r), is_g);
+    numerator = _mm_blendv_ps(numerator, _mm_sub_ps(g, b), is_r);
+    __m128 offset = _mm_blendv_ps(_mm_set1_ps(4.0f), _mm_set1_ps(2.0f), is_g);
+    offset = _mm_blendv_ps(offset, zero, is_r);
+
+    __m128 hue =
+        _mm_blendv_ps(zero, _mm_add_ps(offset, _mm_div_ps(numerator, delta)),
+                      _mm_cmpgt_ps(delta, zero));
+    hue = _mm_blendv_ps(hue, _mm_add_ps(hue, _mm_set1_ps(6.0f)),
+                        _mm_cmplt_ps(hue, zero));
+
+    _mm_storeu_ps(planes[0] + i, _mm_mul_ps(hue, _mm_set1_ps(60.0f)));
+    _mm_storeu_ps(planes[1] + i, _mm_blendv_ps(zero, _mm_div_ps(delta, max),
+                                               _mm_cmpgt_ps(max, zero)));
+    _mm_storeu_ps(planes[2] + i, max);
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  rgb_to_hsv_scalar(rest, n - i);
+}
+
+IMGR_TARGET_SSE41 inline __m128 hsv_channel_sse41(__m128 sextant,
+                                                  __m128 chroma, __m128 value,
+                                                  float n) {
+  const __m128 six = _mm_set1_ps(6.0f);
+  __m128 k = _mm_add_ps(_mm_set1_ps(n), sextant);
+  k = _mm_blendv_ps(k, _mm_sub_ps(k, six), _mm_cmpge_ps(k, six));
+  const __m128 weight = _mm_min_ps(
+      _mm_max_ps(_mm_min_ps(k, _mm_sub_ps(_mm_set1_ps(4.0f), k)),
+                 _mm_setzero_ps()),
+      _mm_set1_ps(1.0f));
+  return _mm_sub_ps(value, _mm_mul_ps(chroma, weight));
+}
+
+IMGR_TARGET_SSE41 inline void hsv_to_rgb_sse41(float* const* planes, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 sextant =
+        _mm_mul_ps(_mm_loadu_ps(planes[0] + i), _mm_set1_ps(1.0f / 60.0f));
+    const __m128 value = _mm_loadu_ps(planes[2] + i);
+    const __m128 chroma = _mm_mul_ps(value, _mm_loadu_ps(planes[1] + i));
+
+    _mm_storeu_ps(planes[0] + i,
+                  hsv_channel_sse41(sextant, chroma, value, 5.0f));
+    _mm_storeu_ps(planes[1] + i,
+                  hsv_channel_sse41(sextant, chroma, value, 3.0f));
+    _mm_storeu_ps(planes[2] + i,
+                  hsv_channel_sse41(sextant, chroma, value, 1.0f));
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  hsv_to_rgb_scalar(rest, n - i);
+}
+
+IMGR_TARGET_AVX2 inline void rgb_to_hsv_avx2(float* const* planes, int n) {
+  const __m256 zero = _mm256_setzero_ps();
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 r = _mm256_loadu_ps(planes[0] + i);
+    const __m256 g = _mm256_loadu_ps(planes[1] + i);
+    const __m256 b = _mm256_loadu_ps(planes[2] + i);
+    const __m256 max = _mm256_max_ps(r, _mm256_max_ps(g, b));
+    const __m256 min = _mm256_min_ps(r, _mm256_min_ps(g, b));
+    const __m256 delta = _mm256_sub_ps(max, min);
+
+    const __m256 is_r = _mm256_cmp_ps(max, r, _CMP_EQ_OQ);
+    const __m256 is_g =
+        _mm256_andnot_ps(is_r, _mm256_cmp_ps(max, g, _CMP_EQ_OQ));
+    __m256 numerator =
+        _mm256_blendv_ps(_mm256_sub_ps(r, g), _mm256_sub_ps(b, r), is_g);
+    numerator = _mm256_blendv_ps(numerator, _mm256_sub_ps(g, b), is_r);
+    __m256 offset =
+        _mm256_blendv_ps(_mm256_set1_ps(4.0f), _mm256_set1_ps(2.0f), is_g);
+    offset = _mm256_blendv_ps(offset, zero, is_r);
+
+    __m256 hue = _mm256_blendv_ps(
+        zero, _mm256_add_ps(offset, _mm256_div_ps(numerator, delta)),
+        _mm256_cmp_ps(delta, zero, _CMP_GT_OQ));
+    hue = _mm256_blendv_ps(hue, _mm256_add_ps(hue, _mm256_set1_ps(6.0f)),
+                           _mm256_cmp_ps(hue, zero, _CMP_LT_OQ));
+
+    _mm256_storeu_ps(planes[0] + i,
+                     _mm256_mul_ps(hue, _mm256_set1_ps(60.0f)));
+    _mm256_storeu_ps(planes[1] + i,
+                     _mm256_blendv_ps(zero, _mm256_div_ps(delta, max),
+                                      _mm256_cmp_ps(max, zero, _CMP_GT_OQ)));
+    _mm256_storeu_ps(planes[2] + i, max);
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  rgb_to_hsv_sse41(rest, n - i);
+}
+
+IMGR_TARGET_AVX2 inline __m256 hsv_channel_avx2(__m256 sextant, __m256 chroma,
+                                                __m256 value, float n) {
+  const __m256 six = _mm256_set1_ps(6.0f);
+  __m256 k = _mm256_add_ps(_mm256_set1_ps(n), sextant);
+  k = _mm256_blendv_ps(k, _mm256_sub_ps(k, six),
+                       _mm256_cmp_ps(k, six, _CMP_GE_OQ));
+  const __m256 weight = _mm256_min_ps(
+      _mm256_max_ps(_mm256_min_ps(k, _mm256_sub_ps(_mm256_set1_ps(4.0f), k)),
+                    _mm256_setzero_ps()),
+      _mm256_set1_ps(1.0f));
+  return _mm256_sub_ps(value, _mm256_mul_ps(chroma, weight));
+}
+
+IMGR_TARGET_AVX2 inline void hsv_to_rgb_avx2(float* const* planes, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 sextant = _mm256_mul_ps(_mm256_loadu_ps(planes[0] + i),
+                                         _mm256_set1_ps(1.0f / 60.0f));
+    const __m256 value = _mm256_loadu_ps(planes[2] + i);
+    const __m256 chroma =
+        _mm256_mul_ps(value, _mm256_loadu_ps(planes[1] + i));
+
+    _mm256_storeu_ps(planes[0] + i,
+                     hsv_channel_avx2(sextant, chroma, value, 5.0f));
+    _mm256_storeu_ps(planes[1] + i,
+                     hsv_channel_avx2(sextant, chroma, value, 3.0f));
+    _mm256_storeu_ps(planes[2] + i,
+                     hsv_channel_avx2(sextant, chroma, value, 1.0f));
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  hsv_to_rgb_sse41(rest, n - i);
+}
+
+#  endif  // IMGR_SIMD_X86
+
+// The planes are streamed from memory once per conversion, so 16-wide
+// vectors would only wait longer on the loads; AVX-512 runs AVX2
+inline RgbToHsvFn select_rgb_to_hsv() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return rgb_to_hsv_avx2;
+  case IsaLevel::sse41:  return rgb_to_hsv_sse41;
+  default:               break;
+  }
+#  endif
+  return rgb_to_hsv_scalar;
+}
+
+inline HsvToRgbFn select_hsv_to_rgb() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return hsv_to_rgb_avx2;
+  case IsaLevel::sse41:  return hsv_to_rgb_sse41;
+  default:               break;
+  }
+#  endif
+  return hsv_to_rgb_scalar;
+}
+
+}  // namespace detail
+
+inline void rgb_to_hsv(float* const* planes, int n) {
+  static const RgbToHsvFn fn = detail::select_rgb_to_hsv();
+  fn(planes, n);
+}
+
+inline void hsv_to_rgb(float* const* planes, int n) {
+  static const HsvToRgbFn fn = detail::select_hsv_to_rgb();
+  fn(planes, n);
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_HSV_H
@@ -0,0 +1,523 @@
+#pragma once
+
+#ifndef IMGR_SIMD_INTERLEAVE_H
+#  define IMGR_SIMD_INTERLEAVE_H
+
+#  include <algorithm>
+#  include <array>
+#  include <cmath>
+#  include <cstdint>
+
+#  include "cpu_features.h"
+
+namespace imgr {
+namespace simd {
+
+// Per colour channel factor between a byte and its float plane value
+using PlaneScale = std::array<float, 3>;
+
+// Splits n interleaved RGB (channels = 3) or RGBA (4) pixels into three float
+// planes, each byte times its channel's scale. Alpha is copied into `alpha`
+// unless that is null.
+using DeinterleaveRowFn = void (*)(const uint8_t* src, int n, int channels,
+                                   const PlaneScale& scale,
+                                   float* const* planes, uint8_t* alpha);
+
+// The other way round: each plane value times its scale, clamped to
+// [0, 255] and rounded to nearest. Alpha comes from `alpha`, or is 255 when
+// that is null.
+using InterleaveRowFn = void (*)(const float* const* planes,
+                                 const uint8_t* alpha, int n, int channels,
+                                 const PlaneScale& scale, uint8_t* dst);
+
+// 8-bit counterparts for planar images: splits n interleaved pixels of 2 to
+// 4 channels into one byte plane per channel, planes[c][i] being byte c of
+// pixel i
+using SplitRowFn = void (*)(const uint8_t* src, int n, int channels,
+                            uint8_t* const* planes);
+
+// And merges such planes back into interleaved pixels
+using MergeRowFn = void (*)(const uint8_t* const* planes, int n,
+                            int channels, uint8_t* dst);
+
+namespace detail {
+
+inline uint8_t plane_to_byte(float value) {
+  return static_cast<uint8_t>(
+      std::nearbyint(std::min(std::max(value, 0.0f), 255.0f)));
+}
+
+inline void deinterleave_row_scalar(const uint8_t* src, int n, int channels,
+                                    const PlaneScale& scale,
+                                    float* const* planes, uint8_t* alpha) {
+  for (int i = 0; i < n; ++i) {
+    const uint8_t* pixel = src + i * channels;
+    planes[0][i] = static_cast<float>(pixel[0]) * scale[0];
+    planes[1][i] = static_cast<float>(pixel[1]) * scale[1];
+    planes[2][i] = static_cast<float>(pixel[2]) * scale[2];
+    if (channels == 4 && alpha != nullptr) {
+      alpha[i] = pixel[3];
+    }
+  }
+}
+
+inline void interleave_row_scalar(const float* const* planes,
+                                  const uint8_t* alpha, int n, int channels,
+                                  const PlaneScale& scale, uint8_t* dst) {
+  for (int i = 0; i < n; ++i) {
+    uint8_t* pixel = dst + i * channels;
+    pixel[0] = plane_to_byte(planes[0][i] * scale[0]);
+    pixel[1] = plane_to_byte(planes[1][i] * scale[1]);
+    pixel[2] = plane_to_byte(planes[2][i] * scale[2]);
+    if (channels == 4) {
+      pixel[3] = alpha != nullptr ? alpha[i] : 255;
+    }
+  }
+}
+
+// 16 pixels of `channels` bytes span `channels` 16-byte blocks. Pixel j's
+// byte c sits at j * channels + c; these pshufb masks pick it out of the
+// block it falls in, -128 zeroing every other lane.
+using ShuffleMask = std::array<int8_t, 16>;
+
+constexpr ShuffleMask gather_mask(int channels, int channel, int block) {
+  ShuffleMask mask{};
+  for (int j = 0; j < 16; ++j) {
+    const int at = j * channels + channel - 16 * block;
+    mask[j] = static_cast<int8_t>(at >= 0 && at < 16 ? at : -128);
+  }
+  return mask;
+}
+
+// Inverse of gather_mask: byte k of an output block takes plane[j] when it
+// is byte `channel` of pixel j
+constexpr ShuffleMask interleave_mask(int channels, int channel, int block) {
+  ShuffleMask mask{};
+  for (int k = 0; k < 16; ++k) {
+    const int at = 16 * block + k;
+    mask[k] = static_cast<int8_t>(at % channels == channel ? at / channels
+                                                           : -128);
+  }
+  return mask;
+}
+
+// Masks indexed [block][channel]; RGB only uses the first three of each
+struct ChannelShuffles {
+  ShuffleMask gather[4][4];
+  ShuffleMask interleave[4][4];
+};
+
+constexpr ChannelShuffles make_channel_shuffles(int channels) {
+  ChannelShuffles shuffles{};
+  for (int block = 0; block < channels; ++block) {
+    for (int c = 0; c < channels; ++c) {
+      shuffles.gather[block][c] = gather_mask(channels, c, block);
+      shuffles.interleave[block][c] = interleave_mask(channels, c, block);
+    }
+  }
+  return shuffles;
+}
+
+constexpr ChannelShuffles kGrayAlphaShuffles = make_channel_shuffles(2);
+constexpr ChannelShuffles kRgbShuffles = make_channel_shuffles(3);
+constexpr ChannelShuffles kRgbaShuffles = make_channel_shuffles(4);
+
+inline const ChannelShuffles& channel_shuffles(int channels) {
+  return channels == 4   ? kRgbaShuffles
+         : channels == 3 ? kRgbShuffles
+                         : kGrayAlphaShuffles;
+}
+
+inline void split_row_scalar(const uint8_t* src, int n, int channels,
+                             uint8_t* const* planes) {
+  for (int i = 0; i < n; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      planes[c][i] = src[i * channels + c];
+    }
+  }
+}
+
+inline void merge_row_scalar(const uint8_t* const* planes, int n,
+                             int channels, uint8_t* dst) {
+  for (int i = 0; i < n; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      dst[i * channels + c] = planes[c][i];
+    }
+  }
+}
+
+#  ifdef IMGR_SIMD_X86
+
+IMGR_TARGET_SSE41 inline __m128i load_mask_sse41(const ShuffleMask& mask) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask.data()));
+}
+
+// The same mask in both 128-bit lanes
+IMGR_TARGET_AVX2 inline __m256i load_mask_avx2(const ShuffleMask& mask) {
+  return _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask.data())));
+}
+
+// 16 interleaved pixels to one 16-byte vector per channel
+IMGR_TARGET_SSE41 inline void deinterleave16_sse41(const uint8_t* in,
+                                                   int channels,
+                                                   __m128i planes[4]) {
+  const ChannelShuffles& shuffles = channel_shuffles(channels);
+  for (int c = 0; c < channels; ++c) {
+    planes[c] = _mm_setzero_si128();
+  }
+  for (int block = 0; block < channels; ++block) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * block));
+    for (int c = 0; c < channels; ++c) {
+      planes[c] = _mm_or_si128(
+          planes[c],
+          _mm_shuffle_epi8(bytes, load_mask_sse41(shuffles.gather[block][c])));
+    }
+  }
+}
+
+IMGR_TARGET_SSE41 inline void interleave16_sse41(const __m128i planes[4],
+                                                 int channels, uint8_t* out) {
+  const ChannelShuffles& shuffles = channel_shuffles(channels);
+  for (int block = 0; block < channels; ++block) {
+    __m128i bytes = _mm_setzero_si128();
+    for (int c = 0; c < channels; ++c) {
+      const __m128i mask = load_mask_sse41(shuffles.interleave[block][c]);
+      bytes = _mm_or_si128(bytes, _mm_shuffle_epi8(planes[c], mask));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block), bytes);
+  }
+}
+
+IMGR_TARGET_SSE41 inline void deinterleave_row_sse41(const uint8_t* src, int n,
+                                                     int channels,
+                                                     const PlaneScale& scale,
+                                                     float* const* planes,
+                                                     uint8_t* alpha) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    deinterleave16_sse41(src + i * channels, channels, bytes);
+    for (int c = 0; c < 3; ++c) {
+      const __m128 factor = _mm_set1_ps(scale[c]);
+      const __m128i quads[4] = {bytes[c], _mm_srli_si128(bytes[c], 4),
+                                _mm_srli_si128(bytes[c], 8),
+                                _mm_srli_si128(bytes[c], 12)};
+      for (int q = 0; q < 4; ++q) {
+        const __m128 value = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(quads[q]));
+        _mm_storeu_ps(planes[c] + i + 4 * q, _mm_mul_ps(value, factor));
+      }
+    }
+    if (channels == 4 && alpha != nullptr) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(alpha + i), bytes[3]);
+    }
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  deinterleave_row_scalar(src + i * channels, n - i, channels, scale, rest,
+                          alpha != nullptr ? alpha + i : nullptr);
+}
+
+IMGR_TARGET_SSE41 inline void interleave_row_sse41(const float* const* planes,
+                                                   const uint8_t* alpha, int n,
+                                                   int channels,
+                                                   const PlaneScale& scale,
+                                                   uint8_t* dst) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max = _mm_set1_ps(255.0f);
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    for (int c = 0; c < 3; ++c) {
+      const __m128 factor = _mm_set1_ps(scale[c]);
+      __m128i quads[4];
+      for (int q = 0; q < 4; ++q) {
+        const __m128 value =
+            _mm_mul_ps(_mm_loadu_ps(planes[c] + i + 4 * q), factor);
+        quads[q] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(value, zero), max));
+      }
+      bytes[c] = _mm_packus_epi16(_mm_packs_epi32(quads[0], quads[1]),
+                                  _mm_packs_epi32(quads[2], quads[3]));
+    }
+    if (channels == 4) {
+      bytes[3] = alpha != nullptr
+                     ? _mm_loadu_si128(
+                           reinterpret_cast<const __m128i*>(alpha + i))
+                     : _mm_set1_epi8(static_cast<char>(255));
+    }
+    interleave16_sse41(bytes, channels, dst + i * channels);
+  }
+  const float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  interleave_row_scalar(rest, alpha != nullptr ? alpha + i : nullptr, n - i,
+                        channels, scale, dst + i * channels);
+}
+
+// pshufb stays within 128-bit lanes, so AVX2 shuffles with the SSE code and
+// only widens the float conversion to 8 pixels
+IMGR_TARGET_AVX2 inline void deinterleave_row_avx2(const uint8_t* src, int n,
+                                                   int channels,
+                                                   const PlaneScale& scale,
+                                                   float* const* planes,
+                                                   uint8_t* alpha) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    deinterleave16_sse41(src + i * channels, channels, bytes);
+    for (int c = 0; c < 3; ++c) {
+      const __m256 factor = _mm256_set1_ps(scale[c]);
+      const __m128i halves[2] = {bytes[c], _mm_srli_si128(bytes[c], 8)};
+      for (int half = 0; half < 2; ++half) {
+        const __m256 value =
+            _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(halves[half]));
+        _mm256_storeu_ps(planes[c] + i + 8 * half,
+                         _mm256_mul_ps(value, factor));
+      }
+    }
+    if (channels == 4 && alpha != nullptr) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(alpha + i), bytes[3]);
+    }
+  }
+  float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  deinterleave_row_scalar(src + i * channels, n - i, channels, scale, rest,
+                          alpha != nullptr ? alpha + i : nullptr);
+}
+
+IMGR_TARGET_AVX2 inline void interleave_row_avx2(const float* const* planes,
+                                                 const uint8_t* alpha, int n,
+                                                 int channels,
+                                                 const PlaneScale& scale,
+                                                 uint8_t* dst) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max = _mm256_set1_ps(255.0f);
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    for (int c = 0; c < 3; ++c) {
+      const __m256 factor = _mm256_set1_ps(scale[c]);
+      __m256i halves[2];
+      for (int half = 0; half < 2; ++half) {
+        const __m256 value = _mm256_mul_ps(
+            _mm256_loadu_ps(planes[c] + i + 8 * half), factor);
+        halves[half] = _mm256_cvtps_epi32(
+            _mm256_min_ps(_mm256_max_ps(value, zero), max));
+      }
+      // packs works per lane, giving pixels 0-3, 8-11, 4-7, 12-15
+      const __m256i words = _mm256_permute4x64_epi64(
+          _mm256_packs_epi32(halves[0], halves[1]), 0xd8);
+      bytes[c] = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                  _mm256_extracti128_si256(words, 1));
+    }
+    if (channels == 4) {
+      bytes[3] = alpha != nullptr
+                     ? _mm_loadu_si128(
+                           reinterpret_cast<const __m128i*>(alpha + i))
+                     : _mm_set1_epi8(static_cast<char>(255));
+    }
+    interleave16_sse41(bytes, channels, dst + i * channels);
+  }
+  const float* const rest[3] = {planes[0] + i, planes[1] + i, planes[2] + i};
+  interleave_row_scalar(rest, alpha != nullptr ? alpha + i : nullptr, n - i,
+                        channels, scale, dst + i * channels);
+}
+
+IMGR_TARGET_SSE41 inline void split_row_sse41(const uint8_t* src, int n,
+                                               int channels,
+                                               uint8_t* const* planes) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    deinterleave16_sse41(src + i * channels, channels, bytes);
+    for (int c = 0; c < channels; ++c) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[c] + i), bytes[c]);
+    }
+  }
+  uint8_t* rest[4];
+  for (int c = 0; c < channels; ++c) {
+    rest[c] = planes[c] + i;
+  }
+  split_row_scalar(src + i * channels, n - i, channels, rest);
+}
+
+IMGR_TARGET_SSE41 inline void merge_row_sse41(const uint8_t* const* planes,
+                                              int n, int channels,
+                                              uint8_t* dst) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes[4];
+    for (int c = 0; c < channels; ++c) {
+      bytes[c] =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[c] + i));
+    }
+    interleave16_sse41(bytes, channels, dst + i * channels);
+  }
+  const uint8_t* rest[4];
+  for (int c = 0; c < channels; ++c) {
+    rest[c] = planes[c] + i;
+  }
+  merge_row_scalar(rest, n - i, channels, dst + i * channels);
+}
+
+// Two groups of 16 pixels per iteration, one per 128-bit lane, so the SSE
+// masks apply unchanged and each plane gets 32 bytes at once
+IMGR_TARGET_AVX2 inline void split_row_avx2(const uint8_t* src, int n,
+                                            int channels,
+                                            uint8_t* const* planes) {
+  const ChannelShuffles& shuffles = channel_shuffles(channels);
+  const int second = 16 * channels;
+
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const uint8_t* in = src + i * channels;
+    __m256i bytes[4];
+    for (int c = 0; c < channels; ++c) {
+      bytes[c] = _mm256_setzero_si256();
+    }
+    for (int block = 0; block < channels; ++block) {
+      const __m256i pixels = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + 16 * block))),
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + second + 16 * block)),
+          1);
+      for (int c = 0; c < channels; ++c) {
+        bytes[c] = _mm256_or_si256(
+            bytes[c],
+            _mm256_shuffle_epi8(pixels,
+                                load_mask_avx2(shuffles.gather[block][c])));
+      }
+    }
+    for (int c = 0; c < channels; ++c) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(planes[c] + i),
+                          bytes[c]);
+    }
+  }
+  uint8_t* rest[4];
+  for (int c = 0; c < channels; ++c) {
+    rest[c] = planes[c] + i;
+  }
+  split_row_sse41(src + i * channels, n - i, channels, rest);
+}
+
+IMGR_TARGET_AVX2 inline void merge_row_avx2(const uint8_t* const* planes,
+                                            int n, int channels,
+                                            uint8_t* dst) {
+  const ChannelShuffles& shuffles = channel_shuffles(channels);
+  const int second = 16 * channels;
+
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    uint8_t* out = dst + i * channels;
+    __m256i bytes[4];
+    for (int c = 0; c < channels; ++c) {
+      bytes[c] = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(planes[c] + i));
+    }
+    for (int block = 0; block < channels; ++block) {
+      __m256i pixels = _mm256_setzero_si256();
+      for (int c = 0; c < channels; ++c) {
+        pixels = _mm256_or_si256(
+            pixels,
+            _mm256_shuffle_epi8(
+                bytes[c], load_mask_avx2(shuffles.interleave[block][c])));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block),
+                       _mm256_castsi256_si128(pixels));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + second + 16 * block),
+                       _mm256_extracti128_si256(pixels, 1));
+    }
+  }
+  const uint8_t* rest[4];
+  for (int c = 0; c < channels; ++c) {
+    rest[c] = planes[c] + i;
+  }
+  merge_row_sse41(rest, n - i, channels, dst + i * channels);
+}
+
+#  endif  // IMGR_SIMD_X86
+
+// Bound by the byte shuffles, which AVX-512 does not widen, so that tier
+// runs AVX2
+inline DeinterleaveRowFn select_deinterleave_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return deinterleave_row_avx2;
+  case IsaLevel::sse41:  return deinterleave_row_sse41;
+  default:               break;
+  }
+#  endif
+  return deinterleave_row_scalar;
+}
+
+inline InterleaveRowFn select_interleave_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return interleave_row_avx2;
+  case IsaLevel::sse41:  return interleave_row_sse41;
+  default:               break;
+  }
+#  endif
+  return interleave_row_scalar;
+}
+
+// AVX-512 would only widen the shuffles to four lanes of a stream that is
+// bound by memory already
+inline SplitRowFn select_split_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return split_row_avx2;
+  case IsaLevel::sse41:  return split_row_sse41;
+  default:               break;
+  }
+#  endif
+  return split_row_scalar;
+}
+
+inline MergeRowFn select_merge_row() {
+#  ifdef IMGR_SIMD_X86
+  switch (isa_level()) {
+  case IsaLevel::avx512:
+  case IsaLevel::avx2:   return merge_row_avx2;
+  case IsaLevel::sse41:  return merge_row_sse41;
+  default:               break;
+  }
+#  endif
+  return merge_row_scalar;
+}
+
+}  // namespace detail
+
+inline void split_row(const uint8_t* src, int n, int channels,
+                      uint8_t* const* planes) {
+  static const SplitRowFn fn = detail::select_split_row();
+  fn(src, n, channels, planes);
+}
+
+inline void merge_row(const uint8_t* const* planes, int n, int channels,
+                      uint8_t* dst) {
+  static const MergeRowFn fn = detail::select_merge_row();
+  fn(planes, n, channels, dst);
+}
+
+inline void deinterleave_row(const uint8_t* src, int n, int channels,
+                             const PlaneScale& scale, float* const* planes,
+                             uint8_t* alpha) {
+  static const DeinterleaveRowFn fn = detail::select_deinterleave_row();
+  fn(src, n, channels, scale, planes, alpha);
+}
+
+inline void interleave_row(const float* const* planes, const uint8_t* alpha,
+                           int n, int channels, const PlaneScale& scale,
+                           uint8_t* dst) {
+  static const InterleaveRowFn fn = detail::select_interleave_row();
+  fn(planes, alpha, n, channels, scale, dst);
+}
+
+}  // namespace simd
+}  // namespace imgr
+
+#endif  // !IMGR_SIMD_INTERLEAVE_H
@@ -3,6 +3,7 @@
 #ifndef UTILS_H
 #  define UTILS_H
 
+#  include <filesystem>
 #  include <fstream>
 #  include <string>
 